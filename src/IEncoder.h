@@ -1,19 +1,223 @@
 ﻿#pragma once
 
+#include <cstdint>
 #include <fstream>
 #include <string>
+#include <vector>
 
-/// Интерфейс, определяющий структуру алгоритмов кодирования 
+#include "BitWriterReader.h"
+#include "memoryStreams.h"
+#include "asyncStreams.h"
+#include "mappedFile.h"
+#include "inputSource.h"
+
+/// Интерфейс, определяющий структуру алгоритмов кодирования
+///
+/// Кодировка реализует кодирование и декодирование над потоками, а упаковка файлов и областей памяти
+/// построена поверх них: в памяти сжатие идет без обращений к файловой системе. Исходный файл отображается
+/// в память, и кодировка работает прямо с отображением; то, что отобразить нельзя (канал, сокет), читается
+/// из потока блоками. В конвейерном режиме упакованный файл пишется (а при распаковке читается) отдельным
+/// потоком выполнения, пока кодировка обрабатывает текущий блок. Поток, который не удалось отобразить,
+/// в конвейерном режиме тоже читается отдельным потоком выполнения; отображение отдельно не читается:
+/// система и так читает его с упреждением (MADV_SEQUENTIAL, FILE_FLAG_SEQUENTIAL_SCAN)
 class IEncoder
 {
 public:
-    virtual void pack(std::ifstream&, std::string directory, std::string fileName) = 0;
+    /// Упаковка файла directory + fileName в directory + "pack/"
+    /// \param file Поток исходного файла (читается, только если файл не удалось отобразить в память)
+    /// \param directory Путь до папки, в которой лежит файл
+    /// \param fileName Имя кодируемого файла
+    void pack(std::ifstream& file, std::string directory, std::string fileName)
+    {
+        MappedFile mapped(directory + fileName);
+        std::string path = directory + "pack/" + fileName + "." + getExtension();
+
+        if (mapped.isOpen())
+        {
+            InputSource input(mapped.data(), mapped.size());
+            packFile(input, path);
+        }
+        else if (!pipelined)
+        {
+            InputSource input(file);
+            packFile(input, path);
+        }
+        else
+        {
+            // Поток за AsyncInput перемотать уже нельзя, поэтому к началу он перематывается здесь (если может)
+            file.clear();
+            file.seekg(0, std::ios_base::beg);
+            file.clear();
+
+            AsyncInput reader(file);
+            std::istream in(&reader);
+
+            InputSource input(in);
+            packFile(input, path);
+        }
+    }
+
+    /// Распаковка файла из directory + "pack/" в directory + "unpack/"
+    /// \param directory Путь до папки, в которой лежит файл
+    /// \param fileName Имя кодируемого файла
+    /// \return false, если упакованный файл поврежден или обрывается (распакованный тогда неполный)
+    bool unpack(std::string directory, std::string fileName)
+    {
+        std::string path = directory + "pack/" + fileName + "." + getExtension();
+        std::ofstream res(directory + "unpack/" + fileName + ".un" + getExtension(), std::ios::binary);
+
+        if (!pipelined)
+        {
+            BitReader br(path);
+            return decode(br, res);
+        }
+
+        std::ifstream packed(path, std::ios::binary);
+        AsyncInput input(packed);
+        std::istream in(&input);
+
+        AsyncOutput output(res);
+        std::ostream out(&output);
+
+        BitReader br(in);
+        bool decoded = decode(br, out);
+        output.close();
+
+        return decoded;
+    }
+
+    /// Конвейерный режим для упаковки и распаковки файлов
+    /// \param enabled Запись упакованного (распакованного) файла, чтение упакованного и неотображенного исходного
+    /// в отдельных потоках выполнения
+    void setPipelined(bool enabled)
+    {
+        pipelined = enabled;
+    }
+
+    /// Упаковка области памяти в массив
+    /// \param data Исходные данные
+    /// \param size Размер исходных данных
+    /// \param out Массив для упакованных данных (прежнее содержимое заменяется)
+    void pack(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+    {
+        out.clear();
+        InputSource input(data, size);
+        MemoryOutput dst(out);
+        packTo(input, dst);
+    }
+
+    /// Упаковка области памяти в буфер вызывающего
+    /// \param data Исходные данные
+    /// \param size Размер исходных данных
+    /// \param out Буфер для упакованных данных
+    /// \param capacity Размер буфера
+    /// \return Размер упакованных данных. Если он больше capacity, в буфер записано только начало,
+    /// и упаковку нужно повторить с буфером нужного размера
+    size_t pack(const uint8_t* data, size_t size, uint8_t* out, size_t capacity)
+    {
+        InputSource input(data, size);
+        MemoryOutput dst(out, capacity);
+        packTo(input, dst);
+
+        return dst.size();
+    }
+
+    /// Распаковка области памяти в массив
+    /// \param data Упакованные данные
+    /// \param size Размер упакованных данных
+    /// \param out Массив для распакованных данных (прежнее содержимое заменяется)
+    /// \return false, если упакованные данные повреждены или обрываются (в out тогда только начало)
+    bool unpack(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+    {
+        out.clear();
+        MemoryOutput dst(out);
 
-    virtual void unpack(std::string directory, std::string fileName) = 0;
+        return unpackTo(data, size, dst);
+    }
+
+    /// Распаковка области памяти в буфер вызывающего
+    /// \param data Упакованные данные
+    /// \param size Размер упакованных данных
+    /// \param out Буфер для распакованных данных
+    /// \param capacity Размер буфера
+    /// \param length Сюда записывается размер распакованных данных. Если он больше capacity, в буфер записано
+    /// только начало
+    /// \return false, если упакованные данные повреждены или обрываются
+    bool unpack(const uint8_t* data, size_t size, uint8_t* out, size_t capacity, size_t& length)
+    {
+        MemoryOutput dst(out, capacity);
+        bool decoded = unpackTo(data, size, dst);
+        length = dst.size();
+
+        return decoded;
+    }
 
     virtual double getCompression() = 0;
 
     virtual ~IEncoder() = default;
 
-    virtual string getName() = 0;
+    virtual std::string getName() = 0;
+
+    /// Расширение упакованного файла (распакованный получает расширение ".un" + getExtension())
+    virtual std::string getExtension() = 0;
+
+protected:
+    /// Кодирование. Кодировка сама перематывает исходные данные к началу: поток мог быть прочитан до конца
+    /// \param input Исходные данные: область памяти или поток (кодировка может проходить их несколько раз)
+    /// \param bw Поток для записи
+    virtual void encode(InputSource& input, BitWriter& bw) = 0;
+
+    /// Декодирование потока
+    /// \param br Поток закодированного сообщения
+    /// \param res Поток для раскодированного сообщения
+    /// \return false, если сообщение повреждено или обрывается: декодирование останавливается на месте ошибки
+    virtual bool decode(BitReader& br, std::ostream& res) = 0;
+
+private:
+    static const size_t HEADER_RESERVE = 4096;     // запас буфера упаковки в память под заголовок
+
+    bool pipelined = false;
+
+    void packFile(InputSource& input, const std::string& path)
+    {
+        if (!pipelined)
+        {
+            BitWriter bw(path);
+            encode(input, bw);
+            bw.close();
+            return;
+        }
+
+        std::ofstream packed(path, std::ios::binary);
+        AsyncOutput output(packed);
+        std::ostream out(&output);
+
+        BitWriter bw(out);
+        encode(input, bw);
+        bw.close();
+        output.close();
+    }
+
+    void packTo(InputSource& input, MemoryOutput& dst)
+    {
+        std::ostream out(&dst);
+
+        // Буфер по размеру данных: упакованные данные обычно больше исходных не больше чем на заголовок,
+        // а если больше - буфер просто сбрасывается в dst несколько раз
+        size_t bufferSize = input.size() + HEADER_RESERVE;
+        if (bufferSize > BitWriter::BUFFER_SIZE)
+            bufferSize = BitWriter::BUFFER_SIZE;
+
+        BitWriter bw(out, bufferSize);
+        encode(input, bw);
+        bw.close();
+    }
+
+    bool unpackTo(const uint8_t* data, size_t size, MemoryOutput& dst)
+    {
+        BitReader br((const char*)data, size);
+        std::ostream res(&dst);
+
+        return decode(br, res);
+    }
 };
\ No newline at end of file
@@ -0,0 +1,313 @@
+﻿#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "IEncoder.h"
+#include "BitWriterReader.h"
+
+using namespace std;
+
+/// Адаптивный алгоритм Хаффмана (алгоритм Виттера)
+/// Кодер и декодер одинаково перестраивают дерево после каждого символа, поэтому частоты не нужно
+/// ни подсчитывать заранее, ни хранить в файле: исходный файл читается один раз, от начала к концу,
+/// а память модели ограничена деревом из 2 * 257 - 1 узлов
+class AdaptiveHuffman : public IEncoder
+{
+public:
+    static const unsigned short NONE = 0xFFFF;      // отсутствующий узел
+    static const int MAX_NODES = 2 * 257 - 1;       // 256 символов и узел NYT
+    static const int ESCAPE_BITS = 9;               // после кода NYT записывается символ или END
+    static const unsigned int END = 256;            // признак конца сообщения
+    static const unsigned int BUFFER_SIZE = 1 << 16;
+
+    /// Коэффицент сжатия для данного алгоритма
+    /// \return Отношение объема исходных данных к закодированным (больше - лучше)
+    double getCompression()
+    {
+        return compression;
+    }
+
+    string getName()
+    {
+        return "Adaptive Haffman";
+    }
+
+    string getExtension()
+    {
+        return "ahaff";
+    }
+
+protected:
+    /// Кодирование адаптивным алгоритмом Хаффмана за один проход
+    /// \param input Исходные данные
+    /// \param bw Поток для записи
+    void encode(InputSource& input, BitWriter& bw)
+    {
+        reset();
+        input.rewind();     // поток мог быть уже прочитан до конца (например, при подсчете частот)
+
+        // Данные проходятся один раз, от начала к концу, порциями
+        unsigned long long size = 0;
+        const char* chunk;
+        size_t count;
+        while ((count = input.read(chunk, BUFFER_SIZE)) != 0)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                unsigned char ch = (unsigned char)chunk[i];
+
+                if (leaf[ch] != NONE)
+                    writePath(leaf[ch], bw);
+                else
+                {
+                    // Новый символ: код NYT, затем сам символ
+                    writePath(nyt, bw);
+                    bw.writeBits(ch, ESCAPE_BITS);
+                }
+
+                update(ch);
+            }
+
+            size += count;
+        }
+
+        writePath(nyt, bw);
+        bw.writeBits(END, ESCAPE_BITS);
+
+        // Определение коэффицента сжатия
+        compression = size / (double)bw.getFileSize();
+    }
+
+    /// Декодирование сообщения, закодированного адаптивным алгоритмом Хаффмана
+    /// \param br Поток закодированного сообщения
+    /// \param res Поток для раскодированного сообщения
+    /// \return false, если поток кончился раньше символа конца сообщения или в нем есть невозможный символ
+    bool decode(BitReader& br, ostream& res)
+    {
+        reset();
+
+        vector<char> buffer(BUFFER_SIZE);
+        unsigned int filled = 0;
+        bool bit;
+
+        while (true)
+        {
+            // Проход от корня до листа
+            unsigned short node = root;
+            while (nodes[node].child[0] != NONE && br >> bit)
+                node = nodes[node].child[bit];
+
+            if (!br)
+                break;
+
+            unsigned int symbol;
+            if (node == nyt)
+            {
+                symbol = br.peekBits(ESCAPE_BITS);
+                br.skipBits(ESCAPE_BITS);
+
+                // Символ за концом потока читается из дополнения нулями: на пустом или оборванном входе
+                // это был бы лишний байт, которого нет в сообщении
+                if (!br || symbol == END)
+                    break;
+
+                // Кодировщик не записывает после NYT ни значений больше END, ни уже встречавшихся символов
+                if (symbol > END || leaf[symbol] != NONE)
+                {
+                    res.write(buffer.data(), filled);
+                    return false;
+                }
+            }
+            else
+                symbol = nodes[node].symbol;
+
+            buffer[filled++] = (char)symbol;
+            if (filled == BUFFER_SIZE)
+            {
+                res.write(buffer.data(), filled);
+                filled = 0;
+            }
+
+            update((unsigned char)symbol);
+        }
+
+        // Цикл заканчивается на символе END или на конце потока, если END так и не встретился
+        res.write(buffer.data(), filled);
+        return br;
+    }
+
+private:
+    /// Узел дерева. Кроме индекса в массиве у узла есть номер: узлы упорядочены по номерам так,
+    /// что веса не убывают, а среди узлов одного веса листья идут раньше внутренних узлов
+    struct Node
+    {
+        unsigned long long weight;
+        unsigned short parent;
+        unsigned short child[2];    // у листа child[0] == NONE
+        unsigned char symbol;
+    };
+
+    /// Начальное состояние модели: дерево из одного узла NYT
+    void reset()
+    {
+        count = 0;
+        root = nyt = addNode(0, MAX_NODES - 1);
+
+        for (int i = 0; i < 256; i++)
+            leaf[i] = NONE;
+    }
+
+    /// Добавление листа
+    /// \param symbol Символ листа
+    /// \param num Номер узла
+    /// \return Индекс нового узла
+    unsigned short addNode(unsigned char symbol, int num)
+    {
+        unsigned short node = count++;
+
+        nodes[node] = Node{ 0, NONE, { NONE, NONE }, symbol };
+        number[node] = num;
+        order[num] = node;
+
+        return node;
+    }
+
+    /// Запись кода узла: путь от корня до узла
+    void writePath(unsigned short node, BitWriter& bw)
+    {
+        int depth = 0;
+        for (; node != root; node = nodes[node].parent)
+            path[depth++] = nodes[nodes[node].parent].child[1] == node;
+
+        // Биты пути собираются в порции по 32 бита
+        unsigned long long value = 0;
+        int length = 0;
+
+        for (int i = depth - 1; i >= 0; i--)
+        {
+            value = (value << 1) | path[i];
+            if (++length == 32)
+            {
+                bw.writeBits(value, length);
+                value = 0;
+                length = 0;
+            }
+        }
+
+        if (length != 0)
+            bw.writeBits(value, length);
+    }
+
+    /// Перестроение дерева после очередного символа
+    void update(unsigned char symbol)
+    {
+        unsigned short q, leafToIncrement = NONE;
+
+        if (leaf[symbol] == NONE)
+        {
+            // NYT становится внутренним узлом: слева новый NYT, справа лист нового символа
+            unsigned short parent = nyt;
+            unsigned short newLeaf = addNode(symbol, number[parent] - 1);
+            nyt = addNode(0, number[parent] - 2);
+
+            nodes[parent].child[0] = nyt;
+            nodes[parent].child[1] = newLeaf;
+            nodes[nyt].parent = nodes[newLeaf].parent = parent;
+            leaf[symbol] = newLeaf;
+
+            q = parent;
+            leafToIncrement = newLeaf;
+        }
+        else
+        {
+            q = leaf[symbol];
+            swapNodes(q, blockLeader(q));
+
+            // Лист рядом с NYT увеличивается после своего родителя
+            if (nodes[q].parent == nodes[nyt].parent)
+            {
+                leafToIncrement = q;
+                q = nodes[q].parent;
+            }
+        }
+
+        while (q != NONE)
+            q = slideAndIncrement(q);
+
+        if (leafToIncrement != NONE)
+            slideAndIncrement(leafToIncrement);
+    }
+
+    /// Узел с наибольшим номером среди узлов того же веса и того же типа (лист или внутренний)
+    unsigned short blockLeader(unsigned short node)
+    {
+        bool isLeaf = nodes[node].child[0] == NONE;
+        int num = number[node];
+
+        while (num + 1 < MAX_NODES)
+        {
+            const Node& next = nodes[order[num + 1]];
+            if (next.weight != nodes[node].weight || (next.child[0] == NONE) != isLeaf)
+                break;
+
+            num++;
+        }
+
+        return order[num];
+    }
+
+    /// Перемещение узла за следующий за ним блок и увеличение его веса
+    /// \return Следующий узел, вес которого нужно увеличить
+    unsigned short slideAndIncrement(unsigned short node)
+    {
+        unsigned long long weight = nodes[node].weight;
+        bool isLeaf = nodes[node].child[0] == NONE;
+        unsigned short parent = nodes[node].parent;
+
+        // Лист сдвигается за внутренние узлы того же веса, внутренний узел - за листья с весом на 1 больше
+        while (number[node] + 1 < MAX_NODES)
+        {
+            unsigned short next = order[number[node] + 1];
+            bool nextIsLeaf = nodes[next].child[0] == NONE;
+
+            if (isLeaf ? nextIsLeaf || nodes[next].weight != weight : !nextIsLeaf || nodes[next].weight != weight + 1)
+                break;
+
+            swapNodes(node, next);
+        }
+
+        nodes[node].weight++;
+
+        return isLeaf ? nodes[node].parent : parent;
+    }
+
+    /// Обмен местами двух узлов в дереве вместе с их номерами
+    void swapNodes(unsigned short a, unsigned short b)
+    {
+        if (a == b)
+            return;
+
+        unsigned short parentA = nodes[a].parent, parentB = nodes[b].parent;
+        int sideA = nodes[parentA].child[1] == a;
+        int sideB = nodes[parentB].child[1] == b;
+
+        nodes[parentA].child[sideA] = b;
+        nodes[parentB].child[sideB] = a;
+        nodes[a].parent = parentB;
+        nodes[b].parent = parentA;
+
+        swap(order[number[a]], order[number[b]]);
+        swap(number[a], number[b]);
+    }
+
+    double compression;
+
+    Node nodes[MAX_NODES];
+    unsigned short number[MAX_NODES];       // номер каждого узла
+    unsigned short order[MAX_NODES];        // узел с каждым номером
+    unsigned short leaf[256];               // лист каждого символа (NONE - символ еще не встречался)
+    unsigned char path[MAX_NODES];          // путь от узла к корню при записи кода
+    unsigned short count, root, nyt;
+};
\ No newline at end of file
@@ -0,0 +1,268 @@
+﻿#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/// Очередь ограниченного размера между двумя потоками выполнения
+template <class T>
+class BoundedQueue
+{
+public:
+    /// \param capacity Максимальное количество элементов в очереди
+    BoundedQueue(size_t capacity)
+    {
+        this->capacity = capacity;
+        closed = false;
+    }
+
+    /// Добавление элемента: если очередь заполнена, ждет свободного места
+    /// \return false, если очередь закрыта
+    bool push(const T& item)
+    {
+        unique_lock<mutex> lock(guard);
+        notFull.wait(lock, [this]() { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+
+        items.push_back(item);
+        notEmpty.notify_one();
+
+        return true;
+    }
+
+    /// Извлечение элемента: если очередь пуста, ждет появления элемента
+    /// \return false, если очередь закрыта
+    bool pop(T& item)
+    {
+        unique_lock<mutex> lock(guard);
+        notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+        if (closed)
+            return false;
+
+        item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+
+        return true;
+    }
+
+    /// Закрытие очереди: ожидающие push и pop сразу возвращают false
+    void close()
+    {
+        lock_guard<mutex> lock(guard);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    deque<T> items;
+    size_t capacity;
+    bool closed;
+
+    mutex guard;
+    condition_variable notFull, notEmpty;
+};
+
+/// Чтение с упреждением: отдельный поток выполнения читает следующие блоки файла, пока кодировка
+/// обрабатывает текущий. Блоки ходят по кругу между очередью свободных и очередью прочитанных.
+/// Поток читается один раз от текущей позиции до конца, переход к другой позиции не поддерживается
+class AsyncInput : public streambuf
+{
+public:
+    static const size_t BLOCK_SIZE = 1 << 20;
+
+    /// \param source Поток файла (чтение идет с текущей позиции)
+    /// \param blocks Количество блоков (3 - тройная буферизация)
+    AsyncInput(istream& source, int blocks = 3)
+        : source(source), buffers(blocks, vector<char>(BLOCK_SIZE)), freeBlocks(blocks), fullBlocks(blocks)
+    {
+        for (int i = 0; i < blocks; i++)
+            freeBlocks.push(i);
+
+        current = -1;
+        atEnd = false;
+        setg(nullptr, nullptr, nullptr);
+
+        reader = thread([this]()
+        {
+            int index;
+            while (freeBlocks.pop(index))
+            {
+                this->source.read(buffers[index].data(), BLOCK_SIZE);
+                size_t count = (size_t)this->source.gcount();
+
+                if (!fullBlocks.push(Block{ index, count }) || count == 0)
+                    break;
+            }
+        });
+    }
+
+    ~AsyncInput()
+    {
+        freeBlocks.close();
+        fullBlocks.close();
+        reader.join();
+    }
+
+protected:
+    int_type underflow()
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        release();
+        if (atEnd)
+            return traits_type::eof();
+
+        Block block;
+        fullBlocks.pop(block);
+
+        if (block.size == 0)
+        {
+            freeBlocks.push(block.index);
+            atEnd = true;
+            return traits_type::eof();
+        }
+
+        current = block.index;
+        char* data = buffers[current].data();
+        setg(data, data, data + block.size);
+
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    /// Прочитанный блок (блок нулевого размера - конец файла)
+    struct Block
+    {
+        int index;
+        size_t size;
+    };
+
+    /// Возвращение текущего блока в очередь свободных
+    void release()
+    {
+        if (current == -1)
+            return;
+
+        freeBlocks.push(current);
+        current = -1;
+        setg(nullptr, nullptr, nullptr);
+    }
+
+private:
+    istream& source;
+
+    vector<vector<char>> buffers;
+    BoundedQueue<int> freeBlocks;       // блоки, которые можно заполнять
+    BoundedQueue<Block> fullBlocks;     // прочитанные блоки по порядку
+    thread reader;
+
+    int current;                        // текущий блок (-1 - нет)
+    bool atEnd;                         // прочитан блок конца файла
+};
+
+/// Запись в отдельном потоке выполнения: заполненный блок отдается записывающему потоку,
+/// а кодировка продолжает писать в следующий свободный блок
+class AsyncOutput : public streambuf
+{
+public:
+    static const size_t BLOCK_SIZE = 1 << 20;
+
+    /// \param target Поток файла
+    /// \param blocks Количество блоков (3 - тройная буферизация)
+    AsyncOutput(ostream& target, int blocks = 3)
+        : target(target), buffers(blocks, vector<char>(BLOCK_SIZE)), freeBlocks(blocks), fullBlocks(blocks)
+    {
+        for (int i = 1; i < blocks; i++)
+            freeBlocks.push(i);
+
+        current = 0;
+        setp(buffers[0].data(), buffers[0].data() + BLOCK_SIZE);
+
+        writer = thread([this]()
+        {
+            Block block;
+            while (fullBlocks.pop(block) && block.size != 0)
+            {
+                this->target.write(buffers[block.index].data(), block.size);
+                freeBlocks.push(block.index);
+            }
+        });
+    }
+
+    ~AsyncOutput()
+    {
+        close();
+    }
+
+    /// Запись оставшихся данных и ожидание записывающего потока выполнения
+    void close()
+    {
+        if (current == -1)
+            return;
+
+        handOff();
+        fullBlocks.push(Block{ -1, 0 });
+        writer.join();
+    }
+
+protected:
+    int_type overflow(int_type ch)
+    {
+        if (current == -1)
+            return traits_type::eof();
+
+        handOff();
+        freeBlocks.pop(current);
+        setp(buffers[current].data(), buffers[current].data() + BLOCK_SIZE);
+
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+
+        return traits_type::not_eof(ch);
+    }
+
+private:
+    /// Блок для записи (блок нулевого размера - конец данных)
+    struct Block
+    {
+        int index;
+        size_t size;
+    };
+
+    /// Передача текущего блока записывающему потоку выполнения
+    void handOff()
+    {
+        size_t filled = pptr() - pbase();
+        if (filled != 0)
+            fullBlocks.push(Block{ current, filled });
+        else
+            freeBlocks.push(current);
+
+        current = -1;
+        setp(nullptr, nullptr);
+    }
+
+private:
+    ostream& target;
+
+    vector<vector<char>> buffers;
+    BoundedQueue<int> freeBlocks;       // блоки, в которые можно писать
+    BoundedQueue<Block> fullBlocks;     // заполненные блоки по порядку
+    thread writer;
+
+    int current;                        // текущий блок (-1 - запись закончена)
+};
\ No newline at end of file
@@ -1,19 +1,50 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iterator>
 #include <string>
+#include <vector>
 
 using namespace std;
 
+/// Запись в файл по битам
+///
+/// Биты накапливаются в 64-битном аккумуляторе, заполненные байты переносятся во внутренний буфер одной
+/// 8-байтовой записью, а буфер уходит в файл порциями по BUFFER_SIZE байт
 class BitWriter
 {
 public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
     BitWriter(const string& path)
+        : buffer(BUFFER_SIZE + 8)   // запас для 8-байтовой записи в конце буфера
     {
         file.open(path, ios::binary);
+        stream = &file;
+        capacity = BUFFER_SIZE;
+
+        filled = 0;
+        written = 0;
+        bufferLength = 0;
+        bits = 0;
+    }
 
+    /// Запись в уже открытый поток (например, в память)
+    /// \param out Поток для записи
+    /// \param bufferSize Размер буфера: для небольших данных в памяти незачем выделять и обнулять BUFFER_SIZE байт
+    BitWriter(ostream& out, size_t bufferSize = BUFFER_SIZE)
+        : buffer(bufferSize + 8)
+    {
+        stream = &out;
+        capacity = bufferSize;
+
+        filled = 0;
+        written = 0;
         bufferLength = 0;
-        byte = 0;
+        bits = 0;
     }
 
     ~BitWriter()
@@ -23,13 +54,28 @@ public:
 
     BitWriter& operator<<(bool bit)
     {
-        if (bit)
-            byte |= byteRank[bufferLength];
+        return writeBits(bit, 1);
+    }
 
-        bufferLength++;
-        
-        if (bufferLength == 8) 
-            writeByte();
+    /// Запись сразу нескольких битов
+    /// \param value Записываемые биты (первым записывается старший из count битов, остальные биты value - нули)
+    /// \param count Количество битов (не больше 57)
+    BitWriter& writeBits(unsigned long long value, int count)
+    {
+        bits = (bits << count) | value;
+        bufferLength += count;
+
+        // Все заполненные байты записываются в буфер сразу: аккумулятор выравнивается по старшему биту
+        // и записывается целиком от старшего байта к младшему, а конец буфера сдвигается на число полных байтов
+        if (bufferLength >= 8)
+        {
+            storeBigEndian(&buffer[filled], bits << (64 - bufferLength));
+            filled += bufferLength / 8;
+            bufferLength %= 8;
+
+            if (filled >= capacity)
+                flush();
+        }
 
         return *this;
     }
@@ -38,20 +84,10 @@ public:
     {
         // Сливаем остатки битового буфера (если буфер заполнен не полностью, то остаток байта запишется нулями,
         // а уже следующие 4 байта будут записаны как unsigned int)
-        if (bufferLength != 0)
-            writeByte();
+        align();
 
-        // Побайтово записываем uint в файл
-        unsigned char ch[4];
         for (int i = 3; i >= 0; i--)
-        {
-            ch[i] = 0;
-            ch[i] |= uint;
-            uint >>= 8;
-        }
-
-        for (int i = 0; i < 4; i++)
-            file << ch[i];
+            putByte((unsigned char)(uint >> (8 * i)));
 
         return *this;
     }
@@ -60,149 +96,415 @@ public:
     {
         // Сливаем остатки битового буфера (если буфер заполнен не полностью, то остаток байта запишется нулями,
         // а уже следующие 2 байта будут записаны как unsigned short int)
-        if (bufferLength != 0)
-            writeByte();
+        align();
 
-        // Побайтово записываем uint в файл
-        unsigned char ch[2];
-        for (int i = 1; i >= 0; i--)
-        {
-            ch[i] = 0;
-            ch[i] |= uint;
-            uint >>= 8;
-        }
-
-        for (int i = 0; i < 2; i++)
-            file << ch[i];
+        putByte((unsigned char)(uint >> 8));
+        putByte((unsigned char)uint);
 
         return *this;
     }
 
+    BitWriter& operator<<(unsigned long long value)
+    {
+        // Старшие 4 байта, затем младшие
+        return *this << (unsigned int)(value >> 32) << (unsigned int)value;
+    }
+
     BitWriter& operator<<(char ch)
     {
         // Сливаем остатки битового буфера (если буфер заполнен не полностью, то остаток байта запишется нулями,
         // а уже в следующий байт пишем наш символ)
-        if (bufferLength != 0)
-            writeByte();
-
-        file << ch;
+        align();
+        putByte((unsigned char)ch);
 
         return *this;
     }
 
-    void close()
+    /// Запись нескольких байт подряд с границы байта
+    /// \param data Записываемые байты
+    /// \param count Количество байт
+    void writeBytes(const char* data, size_t count)
     {
-        if (bufferLength != 0) 
+        align();
+        if (count == 0)
+            return;
+
+        // Большие порции пишутся в файл напрямую, минуя буфер
+        if (filled + count > capacity)
+        {
+            flush();
+            if (count >= capacity)
+            {
+                stream->write(data, count);
+                written += count;
+                return;
+            }
+        }
+
+        memcpy(&buffer[filled], data, count);
+        filled += count;
+    }
+
+    /// Дописывание нулей до границы байта
+    void align()
+    {
+        if (bufferLength != 0)
             writeByte();
+    }
 
-        file.close();
+    void close()
+    {
+        if (stream == nullptr)
+            return;
+
+        align();
+        flush();
+        stream = nullptr;
+
+        if (file.is_open())
+            file.close();
     }
 
-    unsigned int getFileSize()
+    /// Размер записанного файла в байтах, вместе с неполным последним байтом
+    unsigned long long getFileSize()
     {
-        return (unsigned int)file.tellp() + (bufferLength == 0 ? 0 : 1);
+        return written + filled + (bufferLength == 0 ? 0 : 1);
+    }
+
+    /// Количество битов, записанных с начала файла
+    unsigned long long getBitPosition()
+    {
+        return (written + filled) * 8 + bufferLength;
     }
 
 private:
+    /// Запись неполного байта из аккумулятора, недостающие биты заполняются нулями
     void writeByte()
     {
-        file << byte;
+        putByte((unsigned char)(bits << (8 - bufferLength)));
         bufferLength = 0;
-        byte = 0;
+        bits = 0;
+    }
+
+    void putByte(unsigned char byte)
+    {
+        buffer[filled++] = (char)byte;
+        if (filled >= capacity)
+            flush();
+    }
+
+    /// Запись содержимого буфера в файл
+    void flush()
+    {
+        stream->write(buffer.data(), filled);
+        written += filled;
+        filled = 0;
+    }
+
+    /// Запись 8 байт, старший байт value - первым
+    static void storeBigEndian(char* dst, unsigned long long value)
+    {
+#if defined(_MSC_VER)
+        value = _byteswap_uint64(value);
+        memcpy(dst, &value, 8);
+#elif defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        value = __builtin_bswap64(value);
+        memcpy(dst, &value, 8);
+#else
+        for (int i = 0; i < 8; i++)
+            dst[i] = (char)(value >> (56 - 8 * i));
+#endif
     }
 
 private:
     ofstream file;
+    ostream* stream;            // файл или поток, переданный снаружи (nullptr после close)
 
-    int byteRank[8] = {128, 64, 32, 16, 8, 4, 2, 1 };
-    int bufferLength;       // длина буфера (количество битов в буфере на данный момент)
-    unsigned char byte;
+    vector<char> buffer;        // байты, еще не записанные в файл
+    size_t capacity;            // размер буфера без запаса для 8-байтовой записи
+    size_t filled;              // количество байтов в буфере
+    unsigned long long written; // количество байтов, уже записанных в файл
+
+    int bufferLength;           // длина аккумулятора (количество битов в нем на данный момент)
+    unsigned long long bits;    // аккумулятор, незаписанные биты находятся в младших bufferLength битах
 };
 
 
+/// Чтение из файла по битам
+///
+/// Файл читается блоками по BUFFER_SIZE байт во внутренний буфер, за концом данных в буфере всегда лежат
+/// PADDING нулевых байт. Биты берутся из 64-битного регистра, который пополняется одним 8-байтовым чтением
+/// без проверок на каждый бит: поток за концом данных просто дополняется нулями, а выход за конец
+/// учитывается только при подкачке следующего блока
 class BitReader
 {
 public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+    static const size_t PADDING = 8;
+
     BitReader(const string& path)
+        : buffer(BUFFER_SIZE + PADDING + PADDING)   // место под недочитанный хвост предыдущего блока
     {
         file.open(path, ios::binary);
-        
-        bufferRead = 8;
-        byte = 0;
+        stream = &file;
+
+        next = end = buffer.data();
+        reset();
+    }
+
+    /// Чтение из уже открытого потока
+    /// \param in Поток закодированного сообщения
+    BitReader(istream& in)
+        : buffer(BUFFER_SIZE + PADDING + PADDING)
+    {
+        stream = &in;
+
+        next = end = buffer.data();
+        reset();
+    }
+
+    /// Чтение битов из области памяти
+    /// \param data Начало области
+    /// \param size Размер области в байтах
+    BitReader(const char* data, size_t size)
+        : buffer(PADDING + PADDING)     // сюда переносятся последние байты области, чтобы читать их с дополнением
+    {
+        stream = nullptr;
+        next = (const unsigned char*)data;
+        end = next + size;
+        reset();
     }
 
     BitReader& operator>>(bool& bit)
     {
-        if (bufferRead == 8)    // все биты прочитаны, нужно считать новый байт
-            readByte();
-       
-        bit = (byte == (byte | byteRank[bufferRead++]));
+        if (bitCount == 0)      // все биты прочитаны, нужно пополнить регистр
+            refill();
+
+        bit = (bits >> 63) != 0;
+        bits <<= 1;
+        bitCount--;
 
         return *this;
     }
 
     BitReader& operator>>(unsigned int& uint)
     {
-        uint = 0;
-        char ch;
         // Информация в буфере теряется, считываются следущие 4 байта 
-        for (int i = 0; i < 4; i++)
-        {
-            uint <<= 8;
-            file.get(ch);
-            uint |= (unsigned char)ch;
-        }
+        uint = readAligned(32);
 
         return *this;
     }
 
     BitReader& operator>>(unsigned short int& uint)
     {
-        uint = 0;
-        char ch;
-        // Информация в буфере теряется, считываются следущие 4 байта 
-        for (int i = 0; i < 2; i++)
-        {
-            uint <<= 8;
-            file.get(ch);
-            uint |= (unsigned char)ch;
-        }
+        // Информация в буфере теряется, считываются следущие 2 байта 
+        uint = (unsigned short int)readAligned(16);
+
+        return *this;
+    }
+
+    BitReader& operator>>(unsigned long long& value)
+    {
+        unsigned int high, low;
+        *this >> high >> low;
+
+        value = ((unsigned long long)high << 32) | low;
 
         return *this;
     }
 
     BitReader& operator>>(char& ch)
     {
-        ch = 0;
-        file.get(ch);
+        ch = (char)readAligned(8);
 
         return *this;
     }
 
+    /// Просмотр следующих битов без их извлечения из потока
+    /// \param count Количество битов (не больше 32)
+    /// \return Биты, первый прочитанный бит - старший. За концом файла поток дополняется нулями
+    unsigned int peekBits(int count)
+    {
+        if (bitCount < count)
+            refill();
+
+        // Двойной сдвиг, чтобы при count = 0 не сдвигать на 64
+        return (unsigned int)((bits >> 1) >> (63 - count));
+    }
+
+    /// Пропуск битов, уже просмотренных через peekBits
+    void skipBits(int count)
+    {
+        bits <<= count;
+        bitCount -= count;
+    }
+
+    /// Чтение нескольких байт подряд с границы байта
+    /// \param dst Куда записываются байты
+    /// \param count Количество байт
+    void readBytes(char* dst, size_t count)
+    {
+        skipBits(bitCount % 8);
+
+        for (; count != 0 && bitCount >= 8; count--)
+            *dst++ = (char)readAligned(8);
+
+        if (count == 0)
+            return;
+
+        // Регистр пуст, остальные байты копируются прямо из буфера
+        bits = 0;
+        bitCount = 0;
+
+        while (count != 0)
+        {
+            if (next >= end)
+            {
+                // Большие порции читаются из файла напрямую, минуя буфер
+                if (count >= BUFFER_SIZE && stream != nullptr)
+                {
+                    stream->read(dst, count);
+                    size_t n = (size_t)stream->gcount();
+                    overrun += count - n;
+                    memset(dst + n, 0, count - n);
+                    return;
+                }
+
+                fill();
+                if (next == end)
+                {
+                    overrun += count;
+                    memset(dst, 0, count);
+                    return;
+                }
+            }
+
+            size_t n = min(count, (size_t)(end - next));
+            memcpy(dst, next, n);
+            dst += n;
+            next += n;
+            count -= n;
+        }
+    }
+
+    /// Чтение всех оставшихся байт с границы байта
+    /// \param dst Массив, в конец которого дописываются байты
+    void readRest(vector<char>& dst)
+    {
+        skipBits(bitCount % 8);
+
+        while (bitCount >= 8)
+            dst.push_back((char)readAligned(8));
+
+        bits = 0;
+        bitCount = 0;
+
+        if (next < end)
+            dst.insert(dst.end(), (const char*)next, (const char*)end);
+        next = end;
+
+        if (stream != nullptr)
+            dst.insert(dst.end(), istreambuf_iterator<char>(*stream), istreambuf_iterator<char>());
+    }
+
     void close()
     {
         file.close();
     }
 
+    /// \return false, если из потока извлечены биты за концом данных (или файл не открылся)
     operator bool()
     {
-        return (bool)file;
+        // Непрочитанные настоящие биты: регистр и буфер за вычетом нулевого дополнения
+        return (long long)bitCount + 8 * ((end - next) - (long long)overrun) >= 0;
     }
 
 private:
-    void readByte()
+    void reset()
+    {
+        bits = 0;
+        bitCount = 0;
+        overrun = 0;
+    }
+
+    /// Пополнение регистра до 56-63 битов одним 8-байтовым чтением
+    void refill()
     {
-        char ch;
-        file.get(ch);
+        if (end - next < (ptrdiff_t)PADDING)
+            fill();
 
-        byte = (unsigned char)ch;
-        bufferRead = 0;
+        // Байт, попавший в регистр частично, не пропускается и при следующем пополнении читается снова
+        bits |= loadBigEndian(next) >> bitCount;
+        next += (63 - bitCount) >> 3;
+        bitCount |= 56;
+    }
+
+    /// Подкачка следующего блока: недочитанный хвост переносится в начало буфера, за данными - нулевое дополнение
+    void fill()
+    {
+        // Байты за концом данных уже попали в регистр как нулевое дополнение
+        if (next > end)
+        {
+            overrun += next - end;
+            next = end;
+        }
+
+        // Пустая область памяти может начинаться с nullptr, переносить из нее нечего
+        size_t rest = end - next;
+        if (rest != 0)
+            memmove(buffer.data(), next, rest);
+
+        size_t got = 0;
+        if (stream != nullptr)
+        {
+            stream->read((char*)buffer.data() + rest, buffer.size() - rest - PADDING);
+            got = (size_t)stream->gcount();
+        }
+
+        memset(buffer.data() + rest + got, 0, PADDING);
+        next = buffer.data();
+        end = next + rest + got;
+    }
+
+    /// Чтение count битов (8, 16 или 32) с границы байта: недочитанные биты текущего байта теряются
+    unsigned int readAligned(int count)
+    {
+        skipBits(bitCount % 8);
+
+        unsigned int value = peekBits(count);
+        skipBits(count);
+
+        return value;
+    }
+
+public:
+    /// Чтение 8 байт, первый байт - старший
+    static unsigned long long loadBigEndian(const unsigned char* src)
+    {
+        unsigned long long value;
+        memcpy(&value, src, 8);
+
+#if defined(_MSC_VER)
+        return _byteswap_uint64(value);
+#elif defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return __builtin_bswap64(value);
+#else
+        value = 0;
+        for (int i = 0; i < 8; i++)
+            value = (value << 8) | src[i];
+        return value;
+#endif
     }
 
 private:
     ifstream file;
+    istream* stream;                    // файл или поток, переданный снаружи (nullptr - область памяти)
+
+    vector<unsigned char> buffer;       // блок файла (или последние байты области памяти) и нулевое дополнение
+    const unsigned char* next;          // первый байт, еще не попавший в регистр целиком
+    const unsigned char* end;           // конец данных в буфере или в области памяти
+    unsigned long long overrun;         // сколько байт нулевого дополнения уже попало в регистр за концом данных
 
-    int byteRank[8] = { 128, 64, 32, 16, 8, 4, 2, 1 };
-    int bufferRead;             // количество прочитаных битов из буфера
-    unsigned char byte;
-};
\ No newline at end of file
+    unsigned long long bits;    // регистр, непрочитанные биты находятся в старших bitCount битах
+    int bitCount;               // количество непрочитанных битов в регистре
+};
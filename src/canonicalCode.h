@@ -0,0 +1,112 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+/// Канонический префиксный код: коды символов однозначно восстанавливаются по их длинам,
+/// поэтому в заголовке файла достаточно хранить только длины
+class CanonicalCode
+{
+public:
+    /// Назначение канонических кодов по длинам: коды одной длины идут подряд в порядке номеров символов
+    /// \param lengths Длины кодов (0 - символа нет в алфавите)
+    /// \param codes Массив, в который заносятся коды (первый бит кода - старший)
+    /// \param n Количество символов в алфавите
+    static void assignCodes(const unsigned char* lengths, unsigned long long* codes, int n = 256)
+    {
+        int maxLen = 0;
+        for (int s = 0; s < n; s++)
+            if (lengths[s] > maxLen)
+                maxLen = lengths[s];
+
+        // Количество кодов каждой длины
+        vector<unsigned long long> count(maxLen + 1, 0);
+        for (int s = 0; s < n; s++)
+            count[lengths[s]]++;
+        count[0] = 0;
+
+        // Первый код каждой длины
+        vector<unsigned long long> next(maxLen + 1, 0);
+        unsigned long long code = 0;
+        for (int len = 1; len <= maxLen; len++)
+        {
+            code = (code + count[len - 1]) << 1;
+            next[len] = code;
+        }
+
+        for (int s = 0; s < n; s++)
+            codes[s] = lengths[s] != 0 ? next[lengths[s]]++ : 0;
+    }
+
+    /// Построение оптимальных длин кодов, не превышающих maxLen (алгоритм package-merge)
+    /// \param freq Частоты символов
+    /// \param lengths Массив, в который заносятся длины кодов
+    /// \param maxLen Максимальная длина кода (2^maxLen должно быть не меньше количества символов)
+    /// \param n Количество символов в алфавите
+    template <class Count>
+    static void limitLengths(const Count* freq, unsigned char* lengths, int maxLen, int n = 256)
+    {
+        // Листья - встречающиеся символы, упорядоченные по частоте
+        vector<Item> leaves;
+        for (int s = 0; s < n; s++)
+        {
+            lengths[s] = 0;
+            if (freq[s] != 0)
+                leaves.push_back(Item{ freq[s], s, -1, -1 });
+        }
+
+        if (leaves.size() < 2)
+        {
+            for (Item& leaf : leaves)
+                lengths[leaf.symbol] = 1;
+            return;
+        }
+
+        stable_sort(leaves.begin(), leaves.end(), [](const Item& a, const Item& b) { return a.weight < b.weight; });
+
+        // levels[i] - список i-го уровня. Пакет ссылается на пару соседних элементов предыдущего уровня
+        vector<vector<Item>> levels(1, leaves);
+        for (int level = 1; level < maxLen; level++)
+        {
+            const vector<Item>& prev = levels.back();
+            vector<Item> packages;
+            for (int i = 0; i + 1 < (int)prev.size(); i += 2)
+                packages.push_back(Item{ prev[i].weight + prev[i + 1].weight, -1, i, i + 1 });
+
+            vector<Item> merged;
+            merge(leaves.begin(), leaves.end(), packages.begin(), packages.end(), back_inserter(merged),
+                [](const Item& a, const Item& b) { return a.weight < b.weight; });
+
+            levels.push_back(merged);
+        }
+
+        // Длина кода символа - количество его вхождений в первые 2n - 2 элемента последнего списка
+        for (int i = 0; i < 2 * (int)leaves.size() - 2; i++)
+            countLeaves(levels, (int)levels.size() - 1, i, lengths);
+    }
+
+private:
+    /// Элемент списка package-merge: лист (символ) или пакет из двух элементов предыдущего уровня
+    struct Item
+    {
+        unsigned long long weight;
+        int symbol;             // -1 для пакета
+        int first, second;      // индексы элементов пакета на предыдущем уровне
+    };
+
+    static void countLeaves(const vector<vector<Item>>& levels, int level, int i, unsigned char* lengths)
+    {
+        const Item& item = levels[level][i];
+
+        if (item.symbol != -1)
+        {
+            lengths[item.symbol]++;
+            return;
+        }
+
+        countLeaves(levels, level - 1, item.first, lengths);
+        countLeaves(levels, level - 1, item.second, lengths);
+    }
+};
\ No newline at end of file
@@ -0,0 +1,160 @@
+﻿#pragma once
+
+#include <fstream>
+#include <vector>
+
+#include "BitWriterReader.h"
+
+using namespace std;
+
+/// Дерево префиксного кода, хранящееся в одном непрерывном массиве
+/// Узлы ссылаются друг на друга 16-битными индексами. Массив выделяется один раз и переиспользуется
+/// для следующих файлов, поэтому построение дерева не требует выделения памяти под каждый узел
+class CodeTree
+{
+public:
+    static const unsigned short NONE = 0xFFFF;      // отсутствующий узел
+
+    /// Узел дерева
+    struct Node
+    {
+        unsigned short child[2];    // индексы детей по значению очередного бита (у листа child[0] == NONE)
+        unsigned char symbol;       // символ листа
+    };
+
+    CodeTree()
+    {
+        nodes.reserve(512);
+        root = NONE;
+    }
+
+    /// Удаление всех узлов (память массива остается выделенной)
+    void clear()
+    {
+        nodes.clear();
+        root = NONE;
+    }
+
+    /// Добавление листа
+    /// \return Индекс нового узла
+    unsigned short addLeaf(unsigned char symbol)
+    {
+        nodes.push_back(Node{ { NONE, NONE }, symbol });
+        return (unsigned short)(nodes.size() - 1);
+    }
+
+    /// Добавление внутреннего узла
+    /// \param zero Ребенок по биту 0
+    /// \param one Ребенок по биту 1
+    /// \return Индекс нового узла
+    unsigned short addNode(unsigned short zero, unsigned short one)
+    {
+        nodes.push_back(Node{ { zero, one }, 0 });
+        return (unsigned short)(nodes.size() - 1);
+    }
+
+    /// Добавление символа по его коду (недостающие узлы на пути от корня создаются)
+    /// \param code Код символа (первый бит - старший)
+    /// \param len Длина кода
+    /// \param symbol Символ
+    void insert(unsigned long long code, int len, unsigned char symbol)
+    {
+        if (root == NONE)
+            root = addLeaf(0);
+
+        unsigned short node = root;
+        for (int i = len - 1; i >= 0; i--)
+        {
+            int bit = (code >> i) & 1;
+            if (nodes[node].child[bit] == NONE)
+            {
+                unsigned short child = addLeaf(0);
+                nodes[node].child[bit] = child;
+            }
+
+            node = nodes[node].child[bit];
+        }
+
+        nodes[node].symbol = symbol;
+    }
+
+    void setRoot(unsigned short node)
+    {
+        root = node;
+    }
+
+    unsigned short getRoot()
+    {
+        return root;
+    }
+
+    bool isLeaf(unsigned short node)
+    {
+        return nodes[node].child[0] == NONE;
+    }
+
+    const Node& operator[](unsigned short node) const
+    {
+        return nodes[node];
+    }
+
+    Node& operator[](unsigned short node)
+    {
+        return nodes[node];
+    }
+
+    /// Побитовое декодирование проходом по дереву
+    /// \param br Поток закодированного сообщения
+    /// \param out Куда записываются символы
+    /// \param count Количество символов
+    /// \return false, если поток кончился раньше или в нем встретился код, которого нет в дереве
+    bool decode(BitReader& br, char* out, unsigned long long count)
+    {
+        bool bit;
+        unsigned short node = root;
+
+        while (count != 0 && br >> bit)
+        {
+            node = nodes[node].child[bit];
+            if (node == NONE)
+                return false;
+
+            if (nodes[node].child[0] == NONE)
+            {
+                *out++ = (char)nodes[node].symbol;
+                node = root;
+                count--;
+            }
+        }
+
+        return count == 0 && br;
+    }
+
+    /// Побитовое декодирование в поток: символы накапливаются в буфере и записываются блоками
+    /// \param br Поток закодированного сообщения
+    /// \param res Поток для раскодированного сообщения
+    /// \param count Количество символов
+    /// \return false, если поток поврежден (символы после места ошибки не записываются)
+    bool decode(BitReader& br, ostream& res, unsigned long long count)
+    {
+        const unsigned int bufferSize = 1 << 16;
+        vector<char> buffer(bufferSize);
+
+        while (count != 0)
+        {
+            unsigned int part = count < bufferSize ? (unsigned int)count : bufferSize;
+
+            if (!decode(br, buffer.data(), part))
+                return false;
+
+            res.write(buffer.data(), part);
+            count -= part;
+        }
+
+        return true;
+    }
+
+private:
+    vector<Node> nodes;
+    unsigned short root;
+};
\ No newline at end of file
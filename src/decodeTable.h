@@ -0,0 +1,244 @@
+﻿#pragma once
+
+#include <fstream>
+#include <vector>
+
+#include "BitWriterReader.h"
+
+using namespace std;
+
+/// Таблица для декодирования префиксного кода по нескольким битам за раз
+///
+/// Первичная таблица индексируется PRIMARY_BITS следующими битами потока. Если код символа короче индекса,
+/// запись сразу содержит символ (а если хватает бит - то и следующий за ним символ). Для длинных кодов запись
+/// ссылается на вторичную таблицу, которая индексируется следующими битами после уже просмотренных
+class DecodeTable
+{
+public:
+    static const int PRIMARY_BITS = 11;     // ширина первичной таблицы
+
+    /// Запись таблицы
+    struct Entry
+    {
+        unsigned int value;     // символ (первый в младших 8 битах, второй - в следующих) или смещение вторичной таблицы
+        unsigned char count;    // количество символов в записи (0 - ссылка на вторичную таблицу)
+        unsigned char len;      // длина кода первого символа (для ссылки - ширина вторичной таблицы)
+        unsigned char total;    // количество бит, которые занимает вся запись
+    };
+
+    /// Построение таблицы по кодам символов
+    /// \param codes Коды символов (первый бит кода - старший)
+    /// \param lengths Длины кодов (0 - символа нет в алфавите)
+    /// \param n Количество символов в алфавите
+    void build(const unsigned long long* codes, const unsigned char* lengths, int n = 256)
+    {
+        this->codes = codes;
+        this->lengths = lengths;
+        this->n = n;
+
+        // Индексы, с которых не начинается ни один код, пропускают всю ширину таблицы: на поврежденном потоке
+        // декодирование тогда все равно продвигается и останавливается на конце потока
+        table.assign(1 << PRIMARY_BITS, Entry{ 0, 1, PRIMARY_BITS, PRIMARY_BITS });
+        buildLevel(0, 0, 0, PRIMARY_BITS);
+
+        // Два символа в записи помещаются, только если символы - байты
+        if (n > 256)
+            return;
+
+        // Объединение двух коротких кодов в одну запись первичной таблицы
+        vector<Entry> single(table.begin(), table.begin() + (1 << PRIMARY_BITS));
+        unsigned int mask = (1 << PRIMARY_BITS) - 1;
+
+        for (unsigned int i = 0; i <= mask; i++)
+        {
+            Entry& e = table[i];
+            if (e.count != 1 || e.len == 0 || e.len >= PRIMARY_BITS)
+                continue;
+
+            const Entry& next = single[(i << e.len) & mask];
+            if (next.count == 1 && next.len != 0 && e.len + next.len <= PRIMARY_BITS)
+            {
+                e.value |= next.value << 8;
+                e.count = 2;
+                e.total = e.len + next.len;
+            }
+        }
+    }
+
+    /// Декодирование одной записи таблицы
+    /// \param br Поток закодированного сообщения
+    /// \param out Куда записываются символы
+    /// \param left Сколько символов еще осталось декодировать
+    /// \return Количество декодированных символов (один или два)
+    unsigned int decodeEntry(BitReader& br, char* out, unsigned int left) const
+    {
+        const Entry* e = &table[br.peekBits(PRIMARY_BITS)];
+
+        // Длинный код: переход во вторичную таблицу
+        while (e->count == 0)
+        {
+            br.skipBits(e->total);
+            e = &table[e->value + br.peekBits(e->len)];
+        }
+
+        out[0] = (char)e->value;
+
+        if (e->count == 2 && left != 1)
+        {
+            out[1] = (char)(e->value >> 8);
+            br.skipBits(e->total);
+            return 2;
+        }
+
+        br.skipBits(e->len);
+        return 1;
+    }
+
+    /// Декодирование одной записи таблицы по битам регистра, который вызывающий пополняет сам
+    /// \param bits Непрочитанные биты, первый - старший. Их должно быть не меньше длины самого длинного кода
+    /// \param out Куда записываются символы
+    /// \param left Сколько символов еще осталось декодировать
+    /// \param used Сюда записывается количество прочитанных битов
+    /// \return Количество декодированных символов (один или два)
+    unsigned int decodeEntry(unsigned long long bits, char* out, unsigned int left, int& used) const
+    {
+        const Entry* e = &table[bits >> (64 - PRIMARY_BITS)];
+        used = 0;
+
+        // Длинный код: переход во вторичную таблицу
+        while (e->count == 0)
+        {
+            used += e->total;
+            e = &table[e->value + ((bits << used) >> (64 - e->len))];
+        }
+
+        out[0] = (char)e->value;
+
+        if (e->count == 2 && left != 1)
+        {
+            out[1] = (char)(e->value >> 8);
+            used += e->total;
+            return 2;
+        }
+
+        used += e->len;
+        return 1;
+    }
+
+    /// Декодирование одного символа (для алфавитов больше 256 символов)
+    /// \param br Поток закодированного сообщения
+    /// \return Номер символа
+    unsigned int decodeSymbol(BitReader& br) const
+    {
+        const Entry* e = &table[br.peekBits(PRIMARY_BITS)];
+
+        while (e->count == 0)
+        {
+            br.skipBits(e->total);
+            e = &table[e->value + br.peekBits(e->len)];
+        }
+
+        br.skipBits(e->len);
+        return e->count == 2 ? e->value & 0xFF : e->value;
+    }
+
+    /// Декодирование count символов подряд
+    /// \param br Поток закодированного сообщения
+    /// \param out Куда записываются символы
+    /// \param count Количество символов
+    /// \return false, если поток кончился раньше
+    bool decode(BitReader& br, char* out, unsigned long long count) const
+    {
+        while (count != 0)
+        {
+            unsigned int decoded = decodeEntry(br, out, count == 1 ? 1 : 2);
+            out += decoded;
+            count -= decoded;
+        }
+
+        return br;
+    }
+
+    /// Декодирование в поток: символы накапливаются в буфере и записываются блоками
+    /// \param br Поток закодированного сообщения
+    /// \param res Поток для раскодированного сообщения
+    /// \param count Количество символов
+    /// \return false, если поток кончился раньше (последняя неполная часть не записывается)
+    bool decode(BitReader& br, ostream& res, unsigned long long count) const
+    {
+        const unsigned int bufferSize = 1 << 16;
+        vector<char> buffer(bufferSize);
+
+        while (count != 0)
+        {
+            unsigned int part = count < bufferSize ? (unsigned int)count : bufferSize;
+
+            if (!decode(br, buffer.data(), (unsigned long long)part))
+                return false;
+
+            res.write(buffer.data(), part);
+            count -= part;
+        }
+
+        return true;
+    }
+
+private:
+    /// Заполнение таблицы для кодов, начинающихся с заданного префикса
+    /// \param offset Начало таблицы в общем массиве
+    /// \param prefix Уже просмотренные биты кода
+    /// \param prefixLen Количество просмотренных бит
+    /// \param bits Ширина таблицы
+    void buildLevel(unsigned int offset, unsigned long long prefix, int prefixLen, int bits)
+    {
+        vector<bool> isLink(1 << bits, false);
+        vector<int> maxRest(1 << bits, 0);      // длина самого длинного остатка кода для каждой ссылки
+
+        for (int s = 0; s < n; s++)
+        {
+            int len = lengths[s];
+            if (len <= prefixLen || (codes[s] >> (len - prefixLen)) != prefix)
+                continue;
+
+            int rest = len - prefixLen;
+            unsigned long long suffix = codes[s] & ((1ULL << rest) - 1);
+
+            if (rest <= bits)
+            {
+                // Код заканчивается в этой таблице: заполняем все индексы с таким началом
+                unsigned int first = (unsigned int)(suffix << (bits - rest));
+                for (unsigned int i = first; i < first + (1u << (bits - rest)); i++)
+                    table[offset + i] = Entry{ (unsigned int)s, 1, (unsigned char)rest, (unsigned char)rest };
+            }
+            else
+            {
+                unsigned int i = (unsigned int)(suffix >> (rest - bits));
+                isLink[i] = true;
+                if (rest - bits > maxRest[i])
+                    maxRest[i] = rest - bits;
+            }
+        }
+
+        // Вторичные таблицы для длинных кодов
+        for (unsigned int i = 0; i < isLink.size(); i++)
+        {
+            if (!isLink[i])
+                continue;
+
+            int subBits = maxRest[i] < PRIMARY_BITS ? maxRest[i] : PRIMARY_BITS;
+            unsigned int subOffset = (unsigned int)table.size();
+
+            table.resize(table.size() + (1 << subBits), Entry{ 0, 1, (unsigned char)subBits, (unsigned char)subBits });
+            table[offset + i] = Entry{ subOffset, 0, (unsigned char)subBits, (unsigned char)bits };
+
+            buildLevel(subOffset, (prefix << bits) | i, prefixLen + bits, subBits);
+        }
+    }
+
+private:
+    vector<Entry> table;                // первичная таблица, за ней - все вторичные
+
+    const unsigned long long* codes;
+    const unsigned char* lengths;
+    int n;
+};
\ No newline at end of file
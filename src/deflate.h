@@ -0,0 +1,527 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "lz77.h"
+#include "canonicalCode.h"
+#include "decodeTable.h"
+
+using namespace std;
+
+/// LZ77 с кодированием Хаффмана в стиле Deflate
+///
+/// Поиск совпадений (хеш-цепочки и двоичное дерево) берется у LZ77, но блок разбирается не на тройки,
+/// а на литералы и совпадения: за совпадением не обязан идти символ, и совпадения могут идти подряд.
+/// Разбор превращается в символы двух алфавитов: литералы, длины совпадений и конец блока в одном,
+/// смещения - в другом. Длины и смещения кодируются номером интервала и дополнительными битами. Каждый блок
+/// получает свои коды Хаффмана, в заголовке блока записываются только длины канонических кодов. Блоки
+/// совпадают с блоками LZ77: перед каждым записывается 32 бита размера исходного блока, файл заканчивается
+/// нулевым размером
+class Deflate : public LZ77
+{
+public:
+    static const int MAX_CODE_LENGTH = 15;
+    static const int MIN_LENGTH = 3;                        // более короткие совпадения записываются литералами
+    static const unsigned int TOO_FAR = 4096;               // совпадение длины MIN_LENGTH дальше этого дороже литералов
+    static const int LENGTH_BUCKETS = 32;                   // интервалов хватает на длины до 65535 + MIN_LENGTH
+    static const int DISTANCE_BUCKETS = 62;                 // и на смещения до 2^31
+    static const unsigned int MAX_MATCH = 65535 + MIN_LENGTH;
+    static const unsigned int END_OF_BLOCK = 256;
+    static const int LITERALS = 256 + 1 + LENGTH_BUCKETS;   // литералы, конец блока, интервалы длин
+
+    /// \param histBufMax Максимальный размер буфера предыстории (словаря) в килобайтах
+    /// \param prefBufMax Максимальный размер буфера предпросмотра (скользящего окна) в килобайтах
+    /// \param level Уровень сжатия от 1 (быстрее) до 9 (сильнее)
+    /// \param parse Способ разбора файла на тройки
+    Deflate(int histBufMax, int prevBufMax, int level = 6, ParseMode parse = GREEDY)
+        : LZ77(histBufMax, prevBufMax, level, parse)
+    {
+        if (maxMatch > MAX_MATCH)
+            maxMatch = MAX_MATCH;
+
+        // В заголовке блока записываются длины кодов только тех интервалов смещений, которые допускает окно
+        int bits;
+        unsigned int extra;
+        distances = bucket(this->histBufMax - 1, bits, extra) + 1;
+    }
+
+    string getName()
+    {
+        return "Deflate(" + to_string(histBufMax / 1024) + ", " + to_string(prevBufMax / 1024) + ", "
+            + (parse == ULTRA ? "ultra" : "level " + to_string(level)) + ")";
+    }
+
+    string getExtension()
+    {
+        return "defl" + getVariant();
+    }
+
+protected:
+    void writeEnd(BitWriter& bw)
+    {
+        bw.writeBits(0, 32);
+    }
+
+    uint readBlockHeader(BitReader& br)
+    {
+        return readExtra(br, 32);
+    }
+
+    /// Разбор блока на литералы (len = 0, символ в ch) и совпадения (offs, len), за которыми не идет символ
+    void parseBlock(const View& data, int begin, int end, vector<Node>& res)
+    {
+        RuntimeRing ring = { window, (int)histBufMax };
+
+        if (parse == ULTRA)
+            parseOptimal(ring, data, begin, end, res);
+        else
+            parseLazy(ring, data, begin, end, res);
+    }
+
+private:
+    /// Символ алфавита литералов вместе с символом смещения
+    struct Token
+    {
+        unsigned short literal;     // литерал, END_OF_BLOCK или 257 + интервал длины
+        unsigned short lengthExtra;
+        unsigned short distance;    // интервал смещения (только для совпадений)
+        unsigned int distanceExtra;
+    };
+
+    /// Номер интервала для значения: значения до 4 - отдельные интервалы, дальше на каждую степень двойки
+    /// приходится два интервала
+    /// \param value Значение
+    /// \param extraBits Количество дополнительных бит
+    /// \param extra Дополнительные биты (смещение значения от начала интервала)
+    /// \return Номер интервала
+    static unsigned int bucket(unsigned int value, int& extraBits, unsigned int& extra)
+    {
+        if (value < 4)
+        {
+            extraBits = 0;
+            extra = 0;
+            return value;
+        }
+
+        int k = 2;
+        while ((value >> (k + 1)) != 0)
+            k++;
+
+        extraBits = k - 1;
+        extra = value & ((1u << extraBits) - 1);
+
+        return 2 * k + ((value >> extraBits) & 1);
+    }
+
+    /// Начало интервала
+    /// \param code Номер интервала
+    /// \param extraBits Количество дополнительных бит
+    static unsigned int bucketBase(unsigned int code, int& extraBits)
+    {
+        if (code < 4)
+        {
+            extraBits = 0;
+            return code;
+        }
+
+        extraBits = code / 2 - 1;
+        return (2 | (code & 1)) << extraBits;
+    }
+
+    /// Разбор по хеш-цепочкам с ленивой оценкой, как в zlib: если в следующей позиции начинается более длинное
+    /// совпадение, текущий символ записывается литералом, и следующая позиция проверяется так же
+    /// \param ring Индексация циклических массивов
+    /// \param data Окно истории, текущий блок и предпросмотр
+    /// \param begin Начало текущего блока
+    /// \param length Конец текущего блока
+    /// \param res Разбор на литералы и совпадения
+    template <class Ring>
+    void parseLazy(const Ring& ring, const View& data, int begin, int length, vector<Node>& res)
+    {
+        Node next(0, 0, 0);     // совпадение, уже найденное для следующей позиции
+        int nextPos = -1;
+
+        for (int i = begin; i < length; )
+        {
+            Node match = nextPos == i ? next : usefulMatch(ring, data, i, length);
+
+            if (params.lazy != 0 && match.len != 0 && (int)match.len < params.niceLength && i + 1 < length)
+            {
+                next = usefulMatch(ring, data, i + 1, length);
+                nextPos = i + 1;
+
+                if (next.len > match.len)
+                    match.len = 0;
+            }
+
+            if (match.len == 0)
+            {
+                res.push_back(Node(0, 0, data[i]));
+                i++;
+            }
+            else
+            {
+                res.push_back(match);
+                i += match.len;
+            }
+        }
+    }
+
+    /// Самое длинное совпадение, которое выгоднее литералов: не короче MIN_LENGTH и не выходит за конец блока
+    /// \return Совпадение или тройка нулевой длины
+    template <class Ring>
+    Node usefulMatch(const Ring& ring, const View& data, int pos, int length)
+    {
+        insertPositions(ring, data, pos);
+
+        int maxLen = length - pos;
+        if (maxLen > (int)maxMatch)
+            maxLen = maxMatch;
+
+        Node match = findMatch(ring, data, pos, maxLen);
+        if (match.len < MIN_LENGTH || (match.len == MIN_LENGTH && match.offs > TOO_FAR))
+            return Node(0, 0, 0);
+
+        return match;
+    }
+
+    /// Оптимальный разбор: совпадения всех позиций блока один раз ищутся в двоичном дереве LZ77, затем самый
+    /// дешевый путь по ним строится дважды. Первый раз стоимость символов берется из фиксированных кодов
+    /// Deflate, второй - из длин кодов, которые получились бы у первого разбора. Совпадение длиннее
+    /// NICE_LENGTH берется без перебора, позиции внутри него только добавляются в дерево
+    /// \param ring Индексация циклических массивов
+    /// \param data Окно истории, текущий блок и предпросмотр
+    /// \param begin Начало текущего блока
+    /// \param length Конец текущего блока
+    /// \param res Разбор на литералы и совпадения
+    template <class Ring>
+    void parseOptimal(const Ring& ring, const View& data, int begin, int length, vector<Node>& res)
+    {
+        int size = length - begin;
+        vector<Match> matches;
+
+        // found[firstFound[i]..firstFound[i + 1]) - совпадения позиции begin + i по возрастанию длины
+        found.clear();
+        firstFound.resize(size + 1);
+
+        for (int i = begin; i < length; i++)
+        {
+            firstFound[i - begin] = (int)found.size();
+            findMatches(ring, data, i, treeLength(data, i), matches);
+
+            int maxLen = length - i;
+            if (maxLen > (int)maxMatch)
+                maxLen = maxMatch;
+
+            if (!matches.empty() && matches.back().len >= NICE_LENGTH)
+            {
+                Match m = matches.back();
+                const char* cur = &data[i];
+                if (m.len < maxLen)
+                    m.len = extendMatch(cur - m.offs, cur, m.len, maxLen);
+
+                if (m.len > maxLen)
+                    m.len = maxLen;
+
+                found.push_back(m);
+
+                for (int j = i + 1; j < i + m.len; j++)
+                {
+                    firstFound[j - begin] = (int)found.size();
+                    findMatches(ring, data, j, treeLength(data, j), matches);
+                }
+
+                i += m.len - 1;
+                continue;
+            }
+
+            for (Match m : matches)
+            {
+                if (m.len > maxLen)
+                    m.len = maxLen;
+
+                if (m.len >= MIN_LENGTH)
+                    found.push_back(m);
+
+                if (m.len == maxLen)
+                    break;
+            }
+        }
+
+        firstFound[size] = (int)found.size();
+
+        size_t first = res.size();
+
+        setFixedCosts();
+        cheapestPath(data, begin, length, res);
+
+        buildCodes(res.begin() + first, res.end());
+        setCosts();
+        res.resize(first);
+        cheapestPath(data, begin, length, res);
+    }
+
+    /// Самый дешевый разбор блока по найденным совпадениям и текущим стоимостям символов
+    void cheapestPath(const View& data, int begin, int length, vector<Node>& res)
+    {
+        int size = length - begin;
+
+        price.assign(size + 1, UINT_MAX);       // стоимость кодирования начала блока в битах
+        last.resize(size + 1);                  // последний шаг самого дешевого разбора (длина 0 - литерал)
+        price[0] = 0;
+
+        for (int pos = 0; pos < size; pos++)
+        {
+            // Литерал доступен из любой позиции, поэтому price[pos] уже известна
+            step(pos, 1, price[pos] + literalCost[(unsigned char)data[begin + pos]], Match{ 0, 0 });
+
+            int prevLen = MIN_LENGTH - 1;
+            for (int k = firstFound[pos]; k < firstFound[pos + 1]; k++)
+            {
+                const Match& m = found[k];
+
+                int bits;
+                unsigned int extra;
+                unsigned int base = price[pos] + distanceCost[bucket(m.offs - 1, bits, extra)] + bits;
+
+                // Длинное совпадение берется целиком, короче - все длины с самым близким смещением
+                if (m.len >= NICE_LENGTH)
+                    prevLen = m.len - 1;
+
+                for (int len = prevLen + 1; len <= m.len; len++)
+                    step(pos, len, base + lengthCost[len], Match{ len, m.offs });
+
+                prevLen = m.len;
+            }
+        }
+
+        // Восстановление разбора с конца блока
+        size_t first = res.size();
+        for (int end = size; end > 0; )
+        {
+            const Match& m = last[end];
+            if (m.len == 0)
+            {
+                res.push_back(Node(0, 0, data[begin + end - 1]));
+                end--;
+            }
+            else
+            {
+                res.push_back(Node((uint)m.offs, (uint)m.len, 0));
+                end -= m.len;
+            }
+        }
+
+        reverse(res.begin() + first, res.end());
+    }
+
+    /// Обновление стоимости позиции pos + len
+    void step(int pos, int len, unsigned int p, Match m)
+    {
+        if (p < price[pos + len])
+        {
+            price[pos + len] = p;
+            last[pos + len] = m;
+        }
+    }
+
+    /// Стоимости символов по фиксированным кодам Deflate: литералы 8-9 бит, длины 7-8 бит, смещения 5 бит
+    void setFixedCosts()
+    {
+        for (int i = 0; i < LITERALS; i++)
+            literalCost[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+
+        for (int i = 0; i < DISTANCE_BUCKETS; i++)
+            distanceCost[i] = 5;
+
+        setLengthCosts();
+    }
+
+    /// Стоимости символов по длинам кодов последнего buildCodes. Символ без кода стоит как самый длинный код
+    void setCosts()
+    {
+        for (int i = 0; i < LITERALS; i++)
+            literalCost[i] = literalLengths[i] != 0 ? literalLengths[i] : MAX_CODE_LENGTH;
+
+        for (int i = 0; i < distances; i++)
+            distanceCost[i] = distanceLengths[i] != 0 ? distanceLengths[i] : MAX_CODE_LENGTH;
+
+        setLengthCosts();
+    }
+
+    /// Стоимость каждой длины совпадения: символ интервала и дополнительные биты
+    void setLengthCosts()
+    {
+        lengthCost.resize(maxMatch + 1);
+
+        int bits;
+        unsigned int extra;
+        for (uint len = MIN_LENGTH; len <= maxMatch; len++)
+            lengthCost[len] = literalCost[257 + bucket(len - MIN_LENGTH, bits, extra)] + bits;
+    }
+
+    /// Символы алфавитов, длины кодов и канонические коды по разбору блока
+    /// \param first Начало разбора
+    /// \param last Конец разбора
+    void buildCodes(vector<Node>::const_iterator first, vector<Node>::const_iterator last)
+    {
+        tokens.clear();
+        int bits;
+        unsigned int extra;
+
+        for (; first != last; ++first)
+        {
+            const Node& node = *first;
+
+            if (node.len == 0)
+            {
+                tokens.push_back(Token{ (unsigned char)node.ch, 0, 0, 0 });
+                continue;
+            }
+
+            Token token;
+            token.literal = (unsigned short)(257 + bucket(node.len - MIN_LENGTH, bits, extra));
+            token.lengthExtra = (unsigned short)extra;
+            token.distance = (unsigned short)bucket(node.offs - 1, bits, extra);
+            token.distanceExtra = extra;
+            tokens.push_back(token);
+        }
+
+        tokens.push_back(Token{ END_OF_BLOCK, 0, 0, 0 });
+
+        // Частоты, длины кодов и канонические коды обоих алфавитов
+        unsigned int literalFreq[LITERALS] = { 0 };
+        unsigned int distanceFreq[DISTANCE_BUCKETS] = { 0 };
+
+        for (const Token& token : tokens)
+        {
+            literalFreq[token.literal]++;
+            if (token.literal > END_OF_BLOCK)
+                distanceFreq[token.distance]++;
+        }
+
+        CanonicalCode::limitLengths(literalFreq, literalLengths, MAX_CODE_LENGTH, LITERALS);
+        CanonicalCode::limitLengths(distanceFreq, distanceLengths, MAX_CODE_LENGTH, distances);
+        CanonicalCode::assignCodes(literalLengths, literalCodes, LITERALS);
+        CanonicalCode::assignCodes(distanceLengths, distanceCodes, distances);
+    }
+
+    /// Кодирование одного блока
+    /// \param begin Начало текущего блока
+    /// \param end Конец текущего блока
+    /// \param res Разбор блока на литералы и совпадения
+    /// \param bw Поток для записи
+    void writeBlock(const View&, int begin, int end, const vector<Node>& res, BitWriter& bw)
+    {
+        buildCodes(res.begin(), res.end());
+
+        // Заголовок блока: размер исходного блока, длины кодов по 4 бита
+        bw.writeBits(end - begin, 32);
+        for (int i = 0; i < LITERALS; i++)
+            bw.writeBits(literalLengths[i], 4);
+        for (int i = 0; i < distances; i++)
+            bw.writeBits(distanceLengths[i], 4);
+
+        // Коды символов и дополнительные биты
+        int bits;
+        for (const Token& token : tokens)
+        {
+            bw.writeBits(literalCodes[token.literal], literalLengths[token.literal]);
+
+            if (token.literal > END_OF_BLOCK)
+            {
+                bucketBase(token.literal - 257, bits);
+                bw.writeBits(token.lengthExtra, bits);
+
+                bw.writeBits(distanceCodes[token.distance], distanceLengths[token.distance]);
+                bucketBase(token.distance, bits);
+                bw.writeBits(token.distanceExtra, bits);
+            }
+        }
+    }
+
+    /// Декодирование одного блока
+    /// \param br Поток закодированного сообщения
+    /// \param out Куда записывается блок (перед ним лежит окно истории)
+    /// \param size Размер исходного блока
+    /// \return false, если блок поврежден: символы не укладываются ровно в size байт, совпадение ссылается
+    /// раньше начала данных или поток кончился
+    bool decodeBlock(BitReader& br, char* out, uint size)
+    {
+        // Заголовок блока: длины кодов по 4 бита
+        for (int i = 0; i < LITERALS; i++)
+            literalLengths[i] = (unsigned char)readExtra(br, 4);
+        for (int i = 0; i < distances; i++)
+            distanceLengths[i] = (unsigned char)readExtra(br, 4);
+
+        CanonicalCode::assignCodes(literalLengths, literalCodes, LITERALS);
+        CanonicalCode::assignCodes(distanceLengths, distanceCodes, distances);
+        literalTable.build(literalCodes, literalLengths, LITERALS);
+        distanceTable.build(distanceCodes, distanceLengths, distances);
+
+        int bits;
+        char* end = out + size;
+
+        while (true)
+        {
+            unsigned int symbol = literalTable.decodeSymbol(br);
+
+            if (symbol < END_OF_BLOCK)
+            {
+                if (out == end)
+                    return false;
+
+                *out++ = (char)symbol;
+                continue;
+            }
+
+            if (symbol == END_OF_BLOCK)
+                return out == end && br;
+
+            // Совпадение: интервал длины, затем интервал смещения, у каждого - дополнительные биты
+            size_t len = bucketBase(symbol - 257, bits) + MIN_LENGTH;
+            len += readExtra(br, bits);
+
+            unsigned int distance = distanceTable.decodeSymbol(br);
+            unsigned int offs = bucketBase(distance, bits) + 1;
+            offs += readExtra(br, bits);
+
+            if (len > (size_t)(end - out) || offs > (size_t)(out - history))
+                return false;
+
+            copyMatch(out, offs, len);
+            out += len;
+        }
+    }
+
+    /// Чтение bits бит (не больше 32)
+    static unsigned int readExtra(BitReader& br, int bits)
+    {
+        unsigned int extra = br.peekBits(bits);
+        br.skipBits(bits);
+
+        return extra;
+    }
+
+    unsigned char literalLengths[LITERALS];
+    unsigned char distanceLengths[DISTANCE_BUCKETS];
+    unsigned long long literalCodes[LITERALS];
+    unsigned long long distanceCodes[DISTANCE_BUCKETS];
+
+    int distances;              // количество интервалов смещений для данного окна
+    DecodeTable literalTable, distanceTable;
+    vector<Token> tokens;       // символы текущего блока
+
+    // Оптимальный разбор
+    vector<Match> found;                    // совпадения всех позиций блока
+    vector<int> firstFound;                 // начало совпадений каждой позиции в found
+    vector<unsigned int> price;
+    vector<Match> last;
+    unsigned int literalCost[LITERALS];     // стоимость символов в битах
+    unsigned int distanceCost[DISTANCE_BUCKETS];
+    vector<unsigned int> lengthCost;        // стоимость символа длины вместе с дополнительными битами
+};
\ No newline at end of file
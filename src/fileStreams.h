@@ -2,6 +2,7 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -9,17 +10,27 @@ using namespace std;
 class FileStreams
 {
 public:
-    FileStreams()
+    /// \param names Названия алгоритмов - заголовки столбцов таблиц результатов
+    FileStreams(const vector<string>& names)
     {
         fFrequancy.open("../results/frequancy.csv");
         fPackTime.open("../results/packTime.csv");
         fUnpackTime.open("../results/unpackTime.csv");
         fCompression.open("../results/compression.csv");
+        fAllocations.open("../results/allocations.csv");
+        fPipelinedPackTime.open("../results/pipelinedPackTime.csv");
+        fPipelinedUnpackTime.open("../results/pipelinedUnpackTime.csv");
+
+        string title;
+        for (const string& name : names)
+            title += name + ";";
 
-        string title = "Shennon-Fano;Haffman;LZ77(4, 5);LZ77(8, 10);LZ77(16,20);";
         fPackTime << title << endl;
         fUnpackTime << title << endl;
         fCompression << title << endl;
+        fAllocations << title << endl;
+        fPipelinedPackTime << title << endl;
+        fPipelinedUnpackTime << title << endl;
     }
 
     ~FileStreams()
@@ -28,6 +39,9 @@ public:
         fPackTime.close();
         fUnpackTime.close();
         fCompression.close();
+        fAllocations.close();
+        fPipelinedPackTime.close();
+        fPipelinedUnpackTime.close();
     }
     
     void writeFrequancyEntropy(double* freq, double entr)
@@ -55,13 +69,30 @@ public:
         fCompression << c << ";";
     }
 
+    /// Количество выделений динамической памяти при распаковке
+    void writeAllocations(unsigned long long count)
+    {
+        fAllocations << count << ";";
+    }
+
+    /// Время упаковки и распаковки в конвейерном режиме
+    void writePipelinedTime(unsigned int pack, unsigned int unpack)
+    {
+        fPipelinedPackTime << pack << ";";
+        fPipelinedUnpackTime << unpack << ";";
+    }
+
     void endL()
     {
         fPackTime << endl;
         fUnpackTime << endl;
         fCompression << endl;
+        fAllocations << endl;
+        fPipelinedPackTime << endl;
+        fPipelinedUnpackTime << endl;
     }
 
 private:
-     ofstream fFrequancy, fPackTime, fUnpackTime, fCompression;
+     ofstream fFrequancy, fPackTime, fUnpackTime, fCompression, fAllocations;
+     ofstream fPipelinedPackTime, fPipelinedUnpackTime;
 };
\ No newline at end of file
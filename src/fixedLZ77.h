@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+#include "lz77.h"
+
+using namespace std;
+
+/// LZ77 с размерами окон, известными при компиляции
+///
+/// Окно истории - степень двойки, циклические массивы prev и son берутся вдвое больше окна, поэтому номер
+/// ячейки вычисляется маской, а не делением. Разбор на тройки собирается отдельно для каждой конфигурации,
+/// и компилятор подставляет размеры в циклы поиска совпадений. Формат файла совпадает с LZ77(HIST_KB, PREV_KB)
+/// \tparam HIST_KB Размер буфера предыстории (словаря) в килобайтах
+/// \tparam PREV_KB Размер буфера предпросмотра в килобайтах (максимальная длина совпадения)
+template <int HIST_KB, int PREV_KB>
+class FixedLZ77 : public LZ77
+{
+public:
+    static_assert(HIST_KB > 0 && (HIST_KB & (HIST_KB - 1)) == 0, "размер окна должен быть степенью двойки");
+
+    static const int HIST = HIST_KB * 1024;
+    static const int RING = 2 * HIST;       // размер циклических массивов
+
+    /// \param level Уровень сжатия от 1 (быстрее) до 9 (сильнее)
+    /// \param parse Способ разбора файла на тройки
+    FixedLZ77(int level = 6, ParseMode parse = GREEDY)
+        : LZ77(HIST_KB, PREV_KB, level, parse)
+    {
+        window = RING;
+    }
+
+    string getName()
+    {
+        return "LZ77<" + to_string(HIST_KB) + ", " + to_string(PREV_KB) + ">("
+            + (parse == ULTRA ? "ultra" : "level " + to_string(level)) + ")";
+    }
+
+    string getExtension()
+    {
+        return "flz77" + getVariant();
+    }
+
+protected:
+    /// Индексация циклических массивов маской
+    struct FixedRing
+    {
+        static const int hist = HIST;
+
+        static int slot(int pos)
+        {
+            return pos & (RING - 1);
+        }
+    };
+
+    void parseBlock(const View& data, int begin, int end, vector<Node>& res)
+    {
+        FixedRing ring;
+
+        if (parse == ULTRA)
+            encodeOptimal(ring, data, begin, end, res);
+        else
+            encodeGreedy(ring, data, begin, end, res);
+    }
+};
\ No newline at end of file
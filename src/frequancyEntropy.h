@@ -3,6 +3,8 @@
 #include <fstream>
 #include "math.h"
 
+#include "inputSource.h"
+
 
 using namespace std;
 
@@ -11,10 +13,10 @@ class FrequancyEntropy
 {
 public:
     /// Подсчет встречаемости каждого символа и количества символов в файле
-    /// \param fInput Файл для подсчета
+    /// \param fInput Поток для подсчета
     /// \param quantity Массив, в который заносится количество каждого символа из файла
     /// \return Количество символов в файле
-    static unsigned int countFrequancy(ifstream& fInput, unsigned int*& quantity)
+    static unsigned int countFrequancy(istream& fInput, unsigned int*& quantity)
     {   
         quantity = new unsigned int[256];
 
@@ -38,14 +40,59 @@ public:
         return n;
     }
 
+    /// Подсчет встречаемости каждого символа в области памяти
+    /// \param data Начало области
+    /// \param size Размер области
+    /// \param quantity Массив из 256 счетчиков, в который заносится количество каждого символа
+    template <class Count>
+    static void countFrequancy(const char* data, size_t size, Count* quantity)
+    {
+        for (int i = 0; i < 256; i++)
+            quantity[i] = 0;
+
+        for (size_t i = 0; i < size; i++)
+            quantity[(unsigned char)data[i]]++;
+    }
+
+    /// Подсчет встречаемости каждого символа в исходных данных упаковки, порциями с текущей позиции
+    /// \param input Исходные данные
+    /// \param quantity Массив из 256 счетчиков, в который заносится количество каждого символа
+    /// \return Количество прочитанных символов
+    template <class Count>
+    static unsigned long long countFrequancy(InputSource& input, Count* quantity)
+    {
+        for (int i = 0; i < 256; i++)
+            quantity[i] = 0;
+
+        unsigned long long n = 0;
+        const char* chunk;
+        size_t count;
+        while ((count = input.read(chunk, InputSource::CHUNK_SIZE)) != 0)
+        {
+            for (size_t i = 0; i < count; i++)
+                quantity[(unsigned char)chunk[i]]++;
+
+            n += count;
+        }
+
+        return n;
+    }
+
 public:
+    FrequancyEntropy()
+    {
+        freq = nullptr;
+        entropy = 0;
+    }
+
     void count(ifstream& fInput)
     {
         // Подсчет количества символов
         unsigned int* quantity;
         unsigned int sum = countFrequancy(fInput, quantity);
 
-        // Подсчет частоты
+        // Подсчет частоты (массив предыдущего файла освобождается)
+        delete[] freq;
         freq = new double[256];
 
         for (int i = 0; i < 256; i++)
@@ -1,258 +1,724 @@
 ﻿#pragma once
 
+#include <algorithm>
 #include <fstream>
-#include <list>
+#include <functional>
 #include <queue>
 #include <string>
+#include <thread>
 
 #include "IEncoder.h"
 #include "BitWriterReader.h"
 #include "frequancyEntropy.h"
+#include "decodeTable.h"
+#include "canonicalCode.h"
+#include "syncPoints.h"
+#include "codeTree.h"
 
 using namespace std;
  
 /// Алгоритм Хаффмана
+/// В файл записываются только длины канонических кодов, длина кода ограничена MAX_CODE_LENGTH битами
 class Huffman : public IEncoder
 {
 public:
-    /// Кодирование файла по методу Хаффмана
-    /// \param file Поток исходного файла
-    /// \param directory Путь до папки, в которой лежит файл
-    /// \param fileName Имя кодируемого файла
-    void pack(ifstream& file, string directory, string fileName)
+    static const int MAX_CODE_LENGTH = 15;
+    static const unsigned int BLOCK_SIZE = 1 << 18;     // размер блока в формате с четырьмя потоками
+
+    /// Способ декодирования
+    enum DecodeMode
     {
-        // Получение исходных данных: частоты
-        unsigned int* freq;     // массив частот
-        FrequancyEntropy::countFrequancy(file, freq);
+        TREE,       // побитовый проход по дереву кодов
+        TABLE       // поиск по таблице сразу по нескольким битам
+    };
 
-        // Заполнение частотами
-        sheets.reserve(256);
-        for (int i = 0; i < 256; i++)
-            addChance(i, freq[i]);
+    /// Формат закодированного сообщения
+    enum Format
+    {
+        SINGLE_STREAM = 1,  // один битовый поток на весь файл
+        FOUR_STREAMS = 4    // файл делится на блоки, каждый блок - на четыре независимо декодируемых потока
+    };
 
-        // Запуск алгоритма
-        build();
+    /// \param mode Способ декодирования
+    /// \param format Формат закодированного сообщения
+    /// \param threads Количество потоков выполнения для упаковки и распаковки в формате SINGLE_STREAM
+    /// \param syncInterval Расстояние между точками синхронизации в килобайтах исходного файла (0 - без точек)
+    /// в формате SINGLE_STREAM; в формате FOUR_STREAMS не используется, точки синхронизации не записываются.
+    /// Распаковка в несколько потоков выполнения возможна только для файлов с точками синхронизации
+    Huffman(DecodeMode mode = TABLE, Format format = SINGLE_STREAM, unsigned int threads = 1, unsigned int syncInterval = 0)
+        : sync(format == SINGLE_STREAM ? syncInterval * 1024 : 0)
+    {
+        this->mode = mode;
+        this->format = format;
+        this->threads = threads;
+    }
 
-        // Упаковка данных в файл
-        BitWriter bw(directory + "pack/" + fileName + ".haff");
+    /// Коэффицент сжатия для данного алгоритма
+    /// \return Отношение объема исходных данных к закодированным (больше - лучше)
+    double getCompression()
+    {
+        return compression;
+    }
 
-        // Запись частот в файл
-        for (int i = 0; i < 256; i++)
-            bw << sheets[i]->freq;
+    string getName()
+    {
+        string options;
+        if (mode == TREE)
+            options += ", tree";
+        if (format == FOUR_STREAMS)
+            options += ", x4";
+        if (threads > 1)
+            options += ", " + to_string(threads) + " threads";
+
+        return "Haffman" + (options.empty() ? "" : "(" + options.substr(2) + ")");
+    }
 
-        // Запись закодированного сообщения в битах в файл
-        char ch;
-        list<bool> code;
+    string getExtension()
+    {
+        return "haff";
+    }
 
-        file.clear();
-        file.seekg(0);
+protected:
+    /// Кодирование по методу Хаффмана
+    /// \param input Исходные данные
+    /// \param bw Поток для записи
+    void encode(InputSource& input, BitWriter& bw)
+    {
+        // Данные проходятся дважды, поэтому поток, который нельзя перемотать (канал), читается в память.
+        // Частям для разных потоков выполнения тоже нужны все данные сразу
+        bool parallel = threads > 1 && format == SINGLE_STREAM;
+        if (!input.rewind() || parallel)
+            input.load();
 
-        while (file.get(ch))
-        {
-            code = getSymbolCode((unsigned char)ch);
+        // Получение исходных данных: частоты
+        unsigned long long* freq = new unsigned long long[256];     // массив частот (файл может быть больше 4 ГБ)
+        unsigned long long n;
 
-            for (bool bit : code)
-                bw << bit;
+        if (parallel)
+        {
+            n = input.size();
+            countParallel(input.data(), input.size(), freq);
+        }
+        else
+        {
+            n = FrequancyEntropy::countFrequancy(input, freq);
+            input.rewind();
         }
 
+        // Запуск алгоритма: длины кодов и канонические коды по ним
+        buildLengths(freq);
+        CanonicalCode::assignCodes(lengths, codes);
+
+        // Запись заголовка: формат, количество символов (8 байт) и длины кодов (по 4 бита на символ)
+        bw << (char)format;
+        bw << n;
+        for (int i = 0; i < 256; i += 2)
+            bw << (char)((lengths[i] << 4) | lengths[i + 1]);
+
+        bw << sync.getInterval();
+
+        // Запись закодированного сообщения в файл
+        sync.clear();
+
+        if (parallel)
+            encodeParallel(input.data(), input.size(), bw);
+        else if (format == SINGLE_STREAM)
+            encodeStream(input, bw);
+        else
+            encodeBlocks(input, bw);
+
+        if (sync.getInterval() != 0)
+            sync.write(bw);
+
         // Определение коэффицента сжатия
-        file.clear();
-        file.seekg(0, file.end);
-        compression = file.tellg() / (double)bw.getFileSize();
+        compression = n / (double)bw.getFileSize();
 
         // Освобождение ресурсов
-        bw.close();
-        sheets.clear();
         delete[] freq;
-        delete topNode;
     }
 
-    /// Декодирование закодированного файла по методу Хаффмана
-    /// \param file Поток исходного файла
-    /// \param directory Путь до папки, в которой лежит файл
-    /// \param fileName Имя кодируемого файла
-    void unpack(string directory, string fileName)
+    /// Декодирование сообщения, закодированного по методу Хаффмана
+    /// \param br Поток закодированного сообщения
+    /// \param res Поток для раскодированного сообщения
+    /// \return false, если сообщение повреждено или обрывается
+    bool decode(BitReader& br, ostream& res)
     {
-        // Открытие упакованного файла
-        BitReader br(directory + "pack/" + fileName + ".haff");
+        // Считывание заголовка
+        char fileFormat;
+        unsigned long long n;
+        br >> fileFormat >> n;
 
-        // Считывание массива частот
-        unsigned int fr;
-        for (int i = 0; i < 256; i++)
+        char ch;
+        for (int i = 0; i < 256; i += 2)
         {
-            br >> fr;
-            addChance(i, fr);
+            br >> ch;
+            lengths[i] = (unsigned char)ch >> 4;
+            lengths[i + 1] = (unsigned char)ch & 15;
         }
 
-        // Восстановление дерева по массиву частот
-        build();
+        unsigned int syncInterval;
+        br >> syncInterval;
 
-        // Готовим файл для записи раскодированного сообщения
-        ofstream encodeFile;
-        encodeFile.open(directory + "unpack/" + fileName + ".unhaff", ios::binary);
+        if (!br || (fileFormat != SINGLE_STREAM && fileFormat != FOUR_STREAMS))
+            return false;
 
-        // Считывание битов и проход по дереву кодов
-        bool bit;
-        Node* currentNode = topNode;
+        // Непустому сообщению нужен хотя бы один код
+        if (n != 0 && count(lengths, lengths + 256, 0) == 256)
+            return false;
 
-        while (br >> bit)
-        {
-            currentNode = bit ? currentNode->oneChild : currentNode->zeroChild;
+        // Восстановление кодов по длинам
+        CanonicalCode::assignCodes(lengths, codes);
 
-            if (currentNode->isLeaf())
-            {
-                encodeFile << (char)currentNode->ind; // добавление в файл символа
-                currentNode = topNode;
-            }
-        }
+        if (mode == TREE)
+            buildTree();
 
-        // Освобождение ресурсов
-        br.close();
-        encodeFile.close();
-        sheets.clear();
-        delete topNode;
+        if (fileFormat == FOUR_STREAMS)
+            return decodeBlocks(br, n, res);
+        else if (syncInterval != 0 && threads > 1)
+            return decodeParallel(br, n, syncInterval, res);
+        else if (mode == TABLE)
+            return decodeTable(br, n, res);
+        else
+            return tree.decode(br, res, n);
     }
 
-    /// Коэффицент сжатия для данного алгоритма
-    /// \return Отношение объема исходных данных к закодированным (больше - лучше)
-    double getCompression()
+private:
+    /// Кодирование файла одним битовым потоком: код каждого символа берется из таблицы и записывается целиком
+    /// \param input Исходные данные
+    /// \param bw Поток закодированного сообщения
+    void encodeStream(InputSource& input, BitWriter& bw)
     {
-        return compression;
+        unsigned long long start = bw.getBitPosition();
+        unsigned long long position = 0;
+
+        const char* chunk;
+        size_t count;
+        while ((count = input.read(chunk, InputSource::CHUNK_SIZE)) != 0)
+        {
+            for (size_t i = 0; i < count; i++, position++)
+            {
+                if (position == sync.getNext())
+                    sync.add(bw.getBitPosition() - start);
+
+                unsigned char c = (unsigned char)chunk[i];
+                bw.writeBits(codes[c], lengths[c]);
+            }
+        }
     }
 
-    string getName()
+    /// Подсчет частот: каждый поток выполнения считает свою часть, затем счетчики складываются
+    /// \param input Исходные данные
+    /// \param size Размер исходных данных
+    /// \param freq Массив из 256 частот
+    void countParallel(const char* input, size_t size, unsigned long long* freq)
     {
-        return "Haffman";
+        vector<unsigned long long> partFreq(threads * 256);
+        vector<thread> workers;
+
+        for (unsigned int t = 0; t < threads; t++)
+        {
+            size_t begin = chunkBegin(size, t), end = chunkBegin(size, t + 1);
+            workers.emplace_back([input, &partFreq, begin, end, t]()
+            {
+                FrequancyEntropy::countFrequancy(input + begin, end - begin, &partFreq[t * 256]);
+            });
+        }
+
+        for (thread& worker : workers)
+            worker.join();
+
+        for (int i = 0; i < 256; i++)
+        {
+            freq[i] = 0;
+            for (unsigned int t = 0; t < threads; t++)
+                freq[i] += partFreq[t * 256 + i];
+        }
     }
 
-private:
-    /// Построение дерева 
-    void build()
+    /// Кодирование одного битового потока в несколько потоков выполнения
+    /// Для каждой части файла считается длина ее кода в битах, префиксные суммы длин дают смещение каждой части
+    /// в общем выходном буфере. После этого все части кодируются одновременно, и результат совпадает
+    /// с последовательным кодированием
+    /// \param input Исходные данные
+    /// \param size Размер исходных данных
+    /// \param bw Поток закодированного сообщения
+    void encodeParallel(const char* input, size_t size, BitWriter& bw)
     {
-        while (queue.size() != 1)
+        // Длины частей в битах
+        vector<unsigned long long> offsets(threads + 1, 0);
+        vector<thread> workers;
+
+        for (unsigned int t = 0; t < threads; t++)
         {
-            // Извлечение двух минимальных элементов кучи
-            Node* node1 = queue.top();
-            queue.pop();
+            workers.emplace_back([this, input, size, &offsets, t]()
+            {
+                unsigned long long bits = 0;
+                for (size_t i = chunkBegin(size, t); i < chunkBegin(size, t + 1); i++)
+                    bits += lengths[(unsigned char)input[i]];
 
-            Node* node2 = queue.top();
-            queue.pop();
+                offsets[t + 1] = bits;
+            });
+        }
+
+        for (thread& worker : workers)
+            worker.join();
+        workers.clear();
+
+        // Префиксные суммы: смещение каждой части
+        for (unsigned int t = 0; t < threads; t++)
+            offsets[t + 1] += offsets[t];
 
-            // Составление из них одного и добавление в кучу
-            Node* newNode = *node1 + *node2;
+        // Кодирование частей. Байты на стыке частей собираются отдельно и объединяются после завершения потоков
+        vector<char> output((size_t)((offsets[threads] + 7) / 8), 0);
+        vector<vector<pair<size_t, unsigned char>>> edges(threads);
+        vector<vector<SyncPoints::Point>> points(threads);
 
-            queue.push(newNode);
+        for (unsigned int t = 0; t < threads; t++)
+        {
+            workers.emplace_back([this, input, size, &offsets, &output, &edges, &points, t]()
+            {
+                size_t begin = chunkBegin(size, t);
+                encodeChunk(input + begin, chunkBegin(size, t + 1) - begin, begin, offsets[t],
+                    (unsigned char*)output.data(), edges[t], points[t]);
+            });
         }
 
-        topNode = queue.top();      // получение верхнего элемента дерева
-        queue.pop();
-    }
+        for (thread& worker : workers)
+            worker.join();
 
-    /// Добавление в коллекции нового символа
-    /// \param ind Номер символы
-    /// \param chance Частота появления символа
-    void addChance(unsigned char ind, unsigned int freq)
-    {
-        sheets.push_back(new Node(ind, freq));
-        if (freq != 0) 
-            queue.push(sheets.back());
+        for (auto& part : edges)
+            for (auto& edge : part)
+                output[edge.first] |= edge.second;
+
+        for (auto& part : points)
+            sync.append(part);
+
+        bw.writeBytes(output.data(), output.size());
     }
 
-    /// Получение кода символа по его индексу
-    /// \param i Индекс элемента
-    /// \return Код элемента  
-    list<bool> getSymbolCode(unsigned char i)
+    /// Кодирование части файла в общий выходной буфер
+    /// \param data Начало части
+    /// \param count Количество символов в части
+    /// \param first Номер первого символа части в файле
+    /// \param bitOffset Смещение кода части в выходном буфере в битах
+    /// \param output Выходной буфер
+    /// \param edges Байты, которые часть делит с соседними частями (номер байта и биты этой части)
+    /// \param points Точки синхронизации внутри части
+    void encodeChunk(const char* data, size_t count, size_t first, unsigned long long bitOffset, unsigned char* output,
+        vector<pair<size_t, unsigned char>>& edges, vector<SyncPoints::Point>& points)
     {
-        Node* node = sheets[i];
-        list<bool> code;
+        size_t pos = (size_t)(bitOffset / 8);
+        bool sharedFirst = bitOffset % 8 != 0;      // первый байт начат предыдущей частью
+
+        unsigned long long bits = 0;
+        int bitCount = (int)(bitOffset % 8);
+
+        // Первая точка синхронизации внутри части
+        unsigned long long interval = sync.getInterval();
+        unsigned long long nextSync = interval == 0 ? ~0ULL : (first == 0 ? interval : (first + interval - 1) / interval * interval);
 
-        // Проход по дереву вверх 
-        while (node->father)
+        for (size_t i = 0; i < count; i++)
         {
-            code.push_front(node->getCode());
-            node = node->father;
+            if (first + i == nextSync)
+            {
+                points.push_back(SyncPoints::Point{ (unsigned long long)pos * 8 + bitCount, nextSync });
+                nextSync += interval;
+            }
+
+            unsigned char c = (unsigned char)data[i];
+            bits = (bits << lengths[c]) | codes[c];
+            bitCount += lengths[c];
+
+            while (bitCount >= 8)
+            {
+                bitCount -= 8;
+                unsigned char byte = (unsigned char)(bits >> bitCount);
+
+                if (sharedFirst)
+                {
+                    edges.push_back(make_pair(pos, byte));
+                    sharedFirst = false;
+                }
+                else
+                    output[pos] = byte;
+
+                pos++;
+            }
         }
 
-        return code;
+        // Незаконченный последний байт дописывает следующая часть
+        if (bitCount != 0)
+            edges.push_back(make_pair(pos, (unsigned char)(bits << (8 - bitCount))));
     }
 
-private:
-    /// Класс, представлющий собой узел дерева
-    class Node
+    /// Начало части файла для потока выполнения
+    /// \param size Размер файла
+    /// \param t Номер потока выполнения
+    size_t chunkBegin(size_t size, unsigned int t)
+    {
+        return (size_t)((unsigned long long)size * t / threads);
+    }
+
+    /// Кодирование файла блоками по четыре потока
+    /// Блок делится на четыре равные части, каждая кодируется в отдельный поток с границы байта.
+    /// Перед потоками записываются их размеры в байтах
+    /// \param input Исходные данные
+    /// \param bw Поток закодированного сообщения
+    void encodeBlocks(InputSource& input, BitWriter& bw)
     {
-    public:
-        Node(unsigned char ind, unsigned int value)
+        const char* block;
+        unsigned int count;
+        while ((count = (unsigned int)input.read(block, BLOCK_SIZE)) != 0)
         {
-            this->ind = ind;
-            this->freq = value;
-            zeroChild = nullptr;
-            oneChild = nullptr;
+            unsigned int begin[FOUR_STREAMS + 1];
+            splitBlock(count, begin);
+
+            // Размеры потоков
+            for (int k = 0; k < FOUR_STREAMS; k++)
+            {
+                unsigned long long bits = 0;
+                for (unsigned int i = begin[k]; i < begin[k + 1]; i++)
+                    bits += lengths[(unsigned char)block[i]];
+
+                bw << (unsigned int)((bits + 7) / 8);
+            }
+
+            // Потоки
+            for (int k = 0; k < FOUR_STREAMS; k++)
+            {
+                for (unsigned int i = begin[k]; i < begin[k + 1]; i++)
+                {
+                    unsigned char c = (unsigned char)block[i];
+                    bw.writeBits(codes[c], lengths[c]);
+                }
+
+                bw.align();
+            }
         }
+    }
 
-        Node(Node& zeroChild, Node& oneChild)
+    /// Границы частей блока для четырех потоков
+    /// \param count Количество символов в блоке
+    /// \param begin Массив, в который заносятся начала частей (последний элемент - конец блока)
+    void splitBlock(unsigned int count, unsigned int* begin)
+    {
+        unsigned int segment = (count + FOUR_STREAMS - 1) / FOUR_STREAMS;
+
+        for (int k = 0; k <= FOUR_STREAMS; k++)
+            begin[k] = k * segment < count ? k * segment : count;
+    }
+
+    /// Декодирование файла, записанного блоками по четыре потока
+    /// \param br Поток закодированного сообщения
+    /// \param n Количество символов в сообщении
+    /// \param res Поток для раскодированного сообщения
+    /// \return false, если блок поврежден или поток обрывается (блоки после него не записываются)
+    bool decodeBlocks(BitReader& br, unsigned long long n, ostream& res)
+    {
+        DecodeTable table;
+        if (mode == TABLE)
+            table.build(codes, lengths);
+
+        vector<char> block(BLOCK_SIZE);
+        vector<char> packed;
+
+        while (n != 0)
         {
-            this->freq = zeroChild.freq + oneChild.freq;
-            this->zeroChild = &zeroChild;
-            this->oneChild = &oneChild;
+            unsigned int count = n < BLOCK_SIZE ? (unsigned int)n : BLOCK_SIZE;
+            unsigned int begin[FOUR_STREAMS + 1];
+            splitBlock(count, begin);
+
+            // Считывание всех потоков блока в память
+            unsigned int sizes[FOUR_STREAMS];
+            size_t total = 0;
+            for (int k = 0; k < FOUR_STREAMS; k++)
+            {
+                br >> sizes[k];
+                total += sizes[k];
+            }
 
-            zeroChild.father = this;
-            oneChild.father = this;
+            // Код символа не длиннее двух байт: больший размер означает поврежденный заголовок блока
+            if (!br || total > 2 * (size_t)count + FOUR_STREAMS)
+                return false;
+
+            // За последним потоком - запас для 8-байтовых пополнений регистра
+            packed.resize(total + 2 * BitReader::PADDING);
+            br.readBytes(packed.data(), total);
+            if (!br)
+                return false;
+
+            if (mode == TABLE)
+            {
+                if (!decodeStreams(table, packed.data(), sizes, block.data(), begin))
+                    return false;
+            }
+            else
+            {
+                const char* stream = packed.data();
+                for (int k = 0; k < FOUR_STREAMS; stream += sizes[k], k++)
+                {
+                    BitReader part(stream, sizes[k]);
+                    if (!tree.decode(part, block.data() + begin[k], begin[k + 1] - begin[k]))
+                        return false;
+                }
+            }
+
+            res.write(block.data(), count);
+            n -= count;
         }
 
-        ~Node()
+        return true;
+    }
+
+    /// Битовый поток блока, который декодер четырех потоков читает сам
+    struct Stream
+    {
+        const unsigned char* next;  // первый байт, еще не попавший в регистр целиком
+        const unsigned char* end;   // конец потока
+        unsigned long long bits;    // регистр, непрочитанные биты находятся в старших count битах
+        int count;
+        char* out;                  // куда записывается следующий символ
+        unsigned int left;          // сколько символов потока осталось декодировать
+    };
+
+    // После пополнения в регистре не меньше 56 бит, а запись таблицы занимает не больше MAX_CODE_LENGTH бит
+    static const int ENTRIES_PER_REFILL = 56 / MAX_CODE_LENGTH;
+
+    /// Декодирование четырех потоков блока по таблице
+    /// Потоки декодируются поочередно по одной записи таблицы из каждого: цепочки зависимостей разных потоков
+    /// не связаны между собой, и процессор может выполнять их одновременно. Регистры и указатели потоков -
+    /// локальные переменные, регистры пополняются один раз за круг из ENTRIES_PER_REFILL записей каждого потока
+    /// \param table Таблица декодирования
+    /// \param packed Потоки блока подряд, за ними - 2 * BitReader::PADDING байт запаса
+    /// \param sizes Размеры потоков в байтах
+    /// \param block Куда записывается блок
+    /// \param begin Границы частей блока
+    /// \return false, если какой-то поток кончился раньше своей части блока
+    static bool decodeStreams(const DecodeTable& table, const char* packed, const unsigned int* sizes, char* block,
+        const unsigned int* begin)
+    {
+        const unsigned char* next = (const unsigned char*)packed;
+        Stream s0 = openStream(next, sizes[0], block + begin[0], begin[1] - begin[0]);
+        Stream s1 = openStream(next, sizes[1], block + begin[1], begin[2] - begin[1]);
+        Stream s2 = openStream(next, sizes[2], block + begin[2], begin[3] - begin[2]);
+        Stream s3 = openStream(next, sizes[3], block + begin[3], begin[4] - begin[3]);
+
+        // В регистре не больше 7 байт за прочитанными битами, поэтому на целых данных указатель не уходит дальше
+        // PADDING байт за конец своего потока. Поврежденный поток может уйти дальше - тогда круги заканчиваются,
+        // чтобы пополнение не читало за запасом
+        const unsigned char* last = next + BitReader::PADDING;
+        const unsigned int round = 2 * ENTRIES_PER_REFILL;
+
+        while (s0.left >= round && s1.left >= round && s2.left >= round && s3.left >= round &&
+            s0.next <= last && s1.next <= last && s2.next <= last && s3.next <= last)
         {
-            delete zeroChild;
-            delete oneChild;
+            refill(s0);
+            refill(s1);
+            refill(s2);
+            refill(s3);
+
+            for (int i = 0; i < ENTRIES_PER_REFILL; i++)
+            {
+                decodeEntry(table, s0);
+                decodeEntry(table, s1);
+                decodeEntry(table, s2);
+                decodeEntry(table, s3);
+            }
         }
 
-        bool isLeaf()
+        // Остатки потоков
+        for (Stream* s : { &s0, &s1, &s2, &s3 })
         {
-            if (zeroChild == nullptr)
-                return true;
-            else
+            while (s->left != 0)
+            {
+                if (s->next > last)
+                    return false;
+
+                refill(*s);
+                decodeEntry(table, *s);
+            }
+
+            // Из регистра не должны быть извлечены биты за концом потока
+            if ((s->next - s->end) * 8 > s->count)
                 return false;
         }
 
-    public:
-        friend Node* operator +(Node& n1, Node& n2)
+        return true;
+    }
+
+    /// Начало потока блока
+    /// \param next Начало потока, сдвигается на начало следующего
+    static Stream openStream(const unsigned char*& next, unsigned int size, char* out, unsigned int left)
+    {
+        Stream s = { next, next + size, 0, 0, out, left };
+        next += size;
+
+        return s;
+    }
+
+    /// Пополнение регистра до 56-63 битов одним 8-байтовым чтением (как в BitReader)
+    static void refill(Stream& s)
+    {
+        s.bits |= BitReader::loadBigEndian(s.next) >> s.count;
+        s.next += (63 - s.count) >> 3;
+        s.count |= 56;
+    }
+
+    static void decodeEntry(const DecodeTable& table, Stream& s)
+    {
+        int used;
+        unsigned int decoded = table.decodeEntry(s.bits, s.out, s.left, used);
+
+        s.bits <<= used;
+        s.count -= used;
+        s.out += decoded;
+        s.left -= decoded;
+    }
+
+    /// Декодирование по таблице: за одно обращение к таблице читается один или два символа
+    /// \param br Поток закодированного сообщения
+    /// \param n Количество символов в сообщении
+    /// \param res Поток для раскодированного сообщения
+    /// \return false, если поток обрывается
+    bool decodeTable(BitReader& br, unsigned long long n, ostream& res)
+    {
+        DecodeTable table;
+        table.build(codes, lengths);
+
+        return table.decode(br, res, n);
+    }
+
+    /// Декодирование в несколько потоков выполнения по точкам синхронизации
+    /// Весь битовый поток считывается в память, отрезки между точками декодируются одновременно
+    /// \param br Поток закодированного сообщения
+    /// \param n Количество символов в сообщении
+    /// \param syncInterval Расстояние между точками синхронизации в символах
+    /// \param res Поток для раскодированного сообщения
+    /// \return false, если точки синхронизации или битовый поток повреждены (тогда ничего не записывается)
+    bool decodeParallel(BitReader& br, unsigned long long n, unsigned int syncInterval, ostream& res)
+    {
+        vector<char> data;
+        br.readRest(data);
+
+        SyncPoints points(syncInterval);
+        size_t size;
+
+        // Каждый символ занимает хотя бы бит: большее n означает поврежденный заголовок
+        if (!points.read(data, size) || n > (unsigned long long)size * 8)
+            return false;
+
+        DecodeTable table;
+        if (mode == TABLE)
+            table.build(codes, lengths);
+
+        vector<char> output((size_t)n);
+
+        bool decoded = points.decode(data.data(), size, n, output.data(), threads,
+            [this, &table](BitReader& segment, char* out, unsigned long long count)
+            {
+                if (mode == TREE)
+                    return tree.decode(segment, out, count);
+                else
+                    return table.decode(segment, out, count);
+            });
+
+        if (!decoded)
+            return false;
+
+        res.write(output.data(), output.size());
+        return true;
+    }
+
+    /// Построение длин кодов по частотам символов
+    /// Длины берутся из дерева Хаффмана, а если дерево оказалось глубже MAX_CODE_LENGTH - строятся заново
+    /// с ограничением длины
+    /// \param freq Массив частот
+    void buildLengths(unsigned long long* freq)
+    {
+        tree.clear();
+        for (int i = 0; i < 256; i++)
         {
-            Node* node;
+            lengths[i] = 0;
+            if (freq[i] != 0)
+                queue.push(make_pair(freq[i], tree.addLeaf(i)));
+        }
 
-            if (n1.freq < n2.freq)
-                node = new Node(n2, n1);
-            else node = new Node(n1, n2);
+        if (queue.empty())      // пустой файл
+            return;
 
-            return node;
+        build();
+
+        if (tree.isLeaf(tree.getRoot()))      // единственному символу тоже нужен код
+            lengths[tree[tree.getRoot()].symbol] = 1;
+        else
+            collectLengths(tree.getRoot(), 0);
+
+        for (int i = 0; i < 256; i++)
+        {
+            if (lengths[i] > MAX_CODE_LENGTH)
+            {
+                CanonicalCode::limitLengths(freq, lengths, MAX_CODE_LENGTH);
+                break;
+            }
         }
+    }
 
-    public:
-        /// Получение кода символа на данном уровне дерева
-        bool getCode()
+    /// Получение длин кодов всех символов обходом дерева
+    /// \param node Текущий узел
+    /// \param depth Глубина текущего узла
+    void collectLengths(unsigned short node, int depth)
+    {
+        if (tree.isLeaf(node))
         {
-            return this == this->father->zeroChild ? false : true;
+            lengths[tree[node].symbol] = depth;
+            return;
         }
 
-    public:
-        unsigned char ind;     // номер символа
-        unsigned int freq;     // частота встречаемости
-        
-        Node* father;
-        Node* zeroChild;
-        Node* oneChild;
-    };
+        collectLengths(tree[node].child[0], depth + 1);
+        collectLengths(tree[node].child[1], depth + 1);
+    }
 
-    /// Класс - Компаратор 
-    class Compare
+    /// Построение дерева 
+    void build()
     {
-    public:
-        bool operator()(const Node* node1, const Node* node2) const
+        while (queue.size() != 1)
         {
-            return node1->freq > node2->freq;
+            // Извлечение двух минимальных элементов кучи
+            auto node1 = queue.top();
+            queue.pop();
+
+            auto node2 = queue.top();
+            queue.pop();
+
+            // Составление из них одного (более частый - по биту 0) и добавление в кучу
+            queue.push(make_pair(node1.first + node2.first, tree.addNode(node2.second, node1.second)));
         }
-    };
 
+        tree.setRoot(queue.top().second);      // получение верхнего элемента дерева
+        queue.pop();
+    }
+
+    /// Построение дерева кодов по каноническим кодам символов
+    void buildTree()
+    {
+        tree.clear();
+
+        for (int i = 0; i < 256; i++)
+            if (lengths[i] != 0)
+                tree.insert(codes[i], lengths[i], i);
+    }
+
+private:
+    /// Элемент очереди: частота узла и его индекс в дереве
+    typedef pair<unsigned long long, unsigned short> QueueItem;
+
+    DecodeMode mode;
+    Format format;
+    unsigned int threads;
+    SyncPoints sync;                                        // точки синхронизации упаковываемого файла
     double compression;
-    Node* topNode;
-    vector<Node*> sheets;                                   // хранилище всех узлов
-    priority_queue<Node*, vector<Node*>, Compare> queue;    // очередь с приорететом (бинарная куча)
+    CodeTree tree;                                          // дерево кодов (переиспользуется между файлами)
+    unsigned char lengths[256];                             // длины кодов символов
+    unsigned long long codes[256];                          // канонические коды символов
+    priority_queue<QueueItem, vector<QueueItem>, greater<QueueItem>> queue;   // очередь с приорететом (бинарная куча)
 };
\ No newline at end of file
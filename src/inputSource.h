@@ -0,0 +1,134 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <vector>
+
+using namespace std;
+
+/// Исходные данные упаковки: область памяти (отображенный файл, буфер вызывающего) или поток
+///
+/// Кодировки читают данные порциями. Порция области памяти - указатель внутрь нее, без копирования.
+/// Поток читается в буфер не больше запрошенной порции, поэтому канал или файл, который не удалось
+/// отобразить, кодируется в памяти, ограниченной размером порции (и окна LZ77), а не размером файла
+class InputSource
+{
+public:
+    static const size_t CHUNK_SIZE = 1 << 18;       // размер порции для кодировок без своих блоков
+
+    /// \param data Начало области
+    /// \param size Размер области
+    InputSource(const uint8_t* data, size_t size)
+    {
+        stream = nullptr;
+        begin = (const char*)data;
+        length = size;
+        position = 0;
+    }
+
+    /// \param stream Поток, из которого читаются данные (с текущей позиции)
+    explicit InputSource(istream& stream)
+    {
+        this->stream = &stream;
+        begin = nullptr;
+        length = 0;
+        position = 0;
+    }
+
+    /// \return true, если все данные лежат в памяти: тогда доступны data() и size()
+    bool inMemory() const
+    {
+        return stream == nullptr;
+    }
+
+    /// Все данные (только для данных в памяти)
+    const char* data() const
+    {
+        return begin;
+    }
+
+    /// Размер данных (только для данных в памяти)
+    size_t size() const
+    {
+        return length;
+    }
+
+    /// Следующая порция данных
+    /// \param chunk Сюда записывается начало порции (действительно до следующего вызова)
+    /// \param maxSize Наибольший размер порции
+    /// \return Размер порции: меньше maxSize только в конце данных, 0 - данные кончились
+    size_t read(const char*& chunk, size_t maxSize)
+    {
+        if (stream == nullptr)
+        {
+            size_t count = min(maxSize, length - position);
+            chunk = begin + position;
+            position += count;
+
+            return count;
+        }
+
+        buffer.resize(maxSize);
+        stream->read(buffer.data(), maxSize);
+        chunk = buffer.data();
+
+        return (size_t)stream->gcount();
+    }
+
+    /// Возврат к началу данных для следующего прохода
+    /// \return false, если поток нельзя перемотать (канал): чтение продолжается с того же места
+    bool rewind()
+    {
+        if (stream == nullptr)
+        {
+            position = 0;
+            return true;
+        }
+
+        stream->clear();
+        if (stream->seekg(0, ios_base::beg))
+            return true;
+
+        stream->clear();
+        return false;
+    }
+
+    /// Чтение оставшейся части потока в память, когда кодировке нужны все данные сразу
+    /// (несколько проходов по каналу или кодирование частей в разных потоках выполнения)
+    void load()
+    {
+        if (stream == nullptr)
+            return;
+
+        const size_t STEP = 1 << 20;
+        size_t count;
+        do
+        {
+            size_t filled = loaded.size();
+            loaded.resize(filled + STEP);
+            stream->read(loaded.data() + filled, STEP);
+            count = (size_t)stream->gcount();
+            loaded.resize(filled + count);
+        } while (count == STEP);
+
+        stream = nullptr;
+        begin = loaded.data();
+        length = loaded.size();
+        position = 0;
+        buffer = vector<char>();
+    }
+
+private:
+    InputSource(const InputSource&);                // копирование запрещено
+    InputSource& operator=(const InputSource&);
+
+private:
+    istream* stream;            // поток (nullptr - данные в памяти)
+    vector<char> buffer;        // порция потока
+
+    const char* begin;          // данные в памяти
+    size_t length;
+    size_t position;            // начало следующей порции
+    vector<char> loaded;        // поток, прочитанный в память
+};
\ No newline at end of file
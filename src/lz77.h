@@ -1,273 +1,951 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <string>
 #include <vector>
 
 #include "IEncoder.h"
 #include "BitWriterReader.h"
+#include "matchLength.h"
 
 using namespace std;
 
-typedef unsigned short int usint;
 typedef unsigned int uint;
 
+/// Алгоритм LZ77
+/// Разбор файла на тройки (смещение, длина совпадения, символ) записывается последовательностями в стиле LZ4:
+/// байт-токен с длинами отрезка литералов и совпадения по 4 бита, продолжения длин, литералы и смещение.
+/// Смещение занимает от 2 до 4 байт - столько, сколько нужно для окна истории
+///
+/// Файл кодируется блоками по BLOCK_SIZE байт, совпадения могут ссылаться на предыдущие блоки в пределах окна
+/// истории, но не выходят за конец блока. Блок записывается сразу после разбора: размер исходного блока, размер последовательностей,
+/// последовательности. Файл заканчивается блоком нулевого размера. Память кодера и декодера зависит только
+/// от размеров окна, блока и буфера предпросмотра, а не от размера файла
 class LZ77 : public IEncoder
 {
+public:
+    /// Способ разбора файла на тройки
+    enum ParseMode
+    {
+        GREEDY,     // в каждой позиции берется самое длинное совпадение из хеш-цепочки (с ленивой оценкой на уровнях 4-9)
+        ULTRA       // все совпадения из двоичного дерева, самый дешевый разбор выбирается динамическим программированием
+    };
+
+    double getCompression()
+    {
+        return compression;
+    }
+
+    string getName()
+    {
+        return "LZ77(" + to_string(histBufMax / 1024) + ", " + to_string(prevBufMax / 1024) + ", "
+            + (parse == ULTRA ? "ultra" : "level " + to_string(level)) + ")";
+    }
+
+    string getExtension()
+    {
+        return "lz77" + getVariant();
+    }
+
+    /// \param histBufMax Максимальный размер буфера предыстории (словаря) в килобайтах
+    /// \param prefBufMax Максимальный размер буфера предпросмотра (скользящего окна) в килобайтах
+    /// \param level Уровень сжатия от 1 (быстрее) до 9 (сильнее)
+    /// \param parse Способ разбора файла на тройки
+    LZ77(int histBufMax, int prevBufMax, int level = 6, ParseMode parse = GREEDY)
+    {
+        this->histBufMax = (uint)histBufMax * 1024;
+        this->prevBufMax = (uint)prevBufMax * 1024;
+        this->level = level < 1 ? 1 : level > 9 ? 9 : level;
+        this->parse = parse;
+
+        params = getLevel(this->level);
+        extendMatch = MatchLength::select();
+        window = this->histBufMax + 1;     // один лишний элемент
+        maxMatch = this->prevBufMax;
+
+        // Смещение записывается минимальным числом байт, хеш-таблица растет вместе с окном
+        offsetBytes = this->histBufMax < (1u << 16) ? 2 : this->histBufMax < (1u << 24) ? 3 : 4;
+
+        windowHashBits = MIN_HASH_BITS;
+        while (windowHashBits < MAX_HASH_BITS && (1u << windowHashBits) < this->histBufMax)
+            windowHashBits++;
+
+        hashBits = windowHashBits;
+    }
+
 private:
-    /// Кольцевой буфер для хранения символов из истории и просмотра
-    class Buffer
+    LZ77();     // констуруктор по умолчанию запрещен
+
+protected:
+    class Node;
+
+    /// Параметры кодировки для расширения файла, чтобы разные окна и уровни не перезаписывали файлы друг друга
+    /// \return "_окно_предпросмотр_уровень" (вместо уровня "u" для разбора ultra)
+    string getVariant() const
     {
-    public:
-        Buffer(uint histBufMax, uint prevBufMax)
+        return "_" + to_string(histBufMax / 1024) + "_" + to_string(prevBufMax / 1024) + "_"
+            + (parse == ULTRA ? "u" : to_string(level));
+    }
+
+    static const int MIN_MATCH = 3;             // совпадения ищутся по хешу первых MIN_MATCH символов
+    static const int MIN_HASH_BITS = 15;
+    static const int MAX_HASH_BITS = 20;
+    static const int SMALL_HASH_BITS = 10;      // хеш-таблица для небольших данных в памяти
+    static const int NICE_LENGTH = 128;         // при оптимальном разборе совпадение такой длины берется без перебора
+    static const int TREE_LENGTH = 256;         // дальше строки в двоичном дереве не сравниваются
+    static const int MIN_SEQUENCE_MATCH = 4;    // более короткие совпадения записываются литералами
+    static const int BLOCK_SIZE = 1 << 18;      // размер блока исходного файла
+    static const int COPY_SLACK = 32;           // запас в конце буферов декодера для копирования порциями
+
+    /// Кодирование блоками
+    /// \param input Исходные данные
+    /// \param bw Поток для записи
+    void encode(InputSource& input, BitWriter& bw)
+    {
+        input.rewind();
+        resetMatcher(input.inMemory() ? input.size() : SIZE_MAX);
+
+        // Окно истории, текущий блок и буфер предпросмотра за ним - это часть исходных данных в памяти:
+        // окно сдвигается по ним без копирования. Поток читается в буфер, из начала которого
+        // удаляется вышедшее из окна
+        vector<char> buffer;
+        View data = { input.data(), 0 };
+        vector<Node> res;       // тройки текущего блока
+        int begin = 0;          // начало текущего блока
+        unsigned long long size = 0;
+
+        while (true)
         {
-            buff.resize(histBufMax + prevBufMax);
-            size = histBufMax + prevBufMax;
-            sum = 0;
-            end = -1;
+            size_t needed = (size_t)begin + BLOCK_SIZE + maxMatch;
+            if (input.inMemory())
+            {
+                size_t rest = input.size() - (data.begin() - input.data());
+                data.length = (int)min(rest, needed);
+            }
+            else
+            {
+                fillBuffer(input, buffer, needed);
+                data.base = buffer.data();
+                data.length = (int)buffer.size();
+            }
+
+            int end = begin + BLOCK_SIZE < data.length ? begin + BLOCK_SIZE : data.length;
+            if (end == begin)
+                break;
+
+            res.clear();
+            parseBlock(data, begin, end, res);
 
+            writeBlock(data, begin, end, res, bw);
+            size += end - begin;
+
+            int shift = slideWindow(data, end);
+            if (!input.inMemory())
+                buffer.erase(buffer.begin(), buffer.begin() + shift);
+
+            begin = end - shift;
         }
 
-        ~Buffer()
+        writeEnd(bw);
+
+        // Определение коэффицента сжатия
+        compression = size / (double)bw.getFileSize();
+    }
+
+    /// Декодирование блоков до блока нулевого размера
+    /// \param br Поток закодированного сообщения
+    /// \param res Поток для раскодированного сообщения
+    /// \return false, если блок поврежден или поток оборвался до блока нулевого размера
+    bool decode(BitReader& br, ostream& res)
+    {
+        // Блок декодируется сразу за последними histBufMax байтами предыдущих блоков
+        vector<char> output;
+        uint size;
+
+        while ((size = readBlockHeader(br)) != 0)
         {
-            buff.clear();
+            // Кодировщик не пишет блоков больше BLOCK_SIZE
+            if (size > BLOCK_SIZE)
+                return false;
+
+            size_t begin = output.size();
+            output.resize(begin + size + COPY_SLACK);
+            history = output.data();
+
+            if (!decodeBlock(br, &output[begin], size))
+                return false;       // поврежденный блок не записывается
+
+            res.write(&output[begin], size);
+            output.resize(begin + size);
+
+            // История сдвигается, только когда буфер вырос вдвое, чтобы большое окно не копировалось на каждом блоке
+            if (output.size() > 2 * (size_t)histBufMax)
+                output.erase(output.begin(), output.end() - histBufMax);
         }
 
-        void addChar(char ch)
+        // Нулевой размер мог прочитаться из дополнения за концом потока
+        return (bool)br;
+    }
+
+    /// Параметры уровня сжатия
+    struct Level
+    {
+        int maxChain;       // максимальное количество позиций, просматриваемых при поиске совпадения
+        int niceLength;     // достаточная длина: поиск прекращается, ленивая оценка не выполняется
+        int lazy;           // в скольких следующих позициях ищется более длинное совпадение, ради которого текущее откладывается
+    };
+
+    /// Уровни подобраны так, чтобы с ростом уровня упакованный файл не становился больше. Более длинные цепочки
+    /// на последних уровнях почти не уменьшают файл, а на части файлов жадный разбор от них даже проигрывает
+    static Level getLevel(int level)
+    {
+        static const Level levels[9] =
         {
-            sum++;
-            end = (end + 1) % size;
-            buff[end] = ch;         
+            { 4, 8, 0 },
+            { 8, 16, 0 },
+            { 16, 32, 0 },
+            { 16, 32, 1 },
+            { 32, 64, 1 },
+            { 128, 128, 1 },
+            { 128, 128, 2 },
+            { 256, 256, 2 },
+            { 512, 258, 2 }
+        };
+
+        return levels[level - 1];
+    }
+
+    /// Совпадение, найденное в двоичном дереве
+    struct Match
+    {
+        int len;
+        int offs;
+    };
+
+    /// Окно истории, текущий блок и предпросмотр: часть исходных данных, от начала которой отсчитываются позиции
+    struct View
+    {
+        const char* base;
+        int length;
+
+        const char& operator[](size_t i) const
+        {
+            return base[i];
         }
 
-        char getChar(uint i)
+        size_t size() const
         {
-            return buff[i % size];
+            return length;
         }
 
-        uint sum;
-        usint size;
-        int beg, end;
-        vector<char> buff;
+        const char* begin() const
+        {
+            return base;
+        }
     };
 
-public:
-    void pack(ifstream& file, string directory, string fileName)
+    /// Индексация циклических массивов prev и son, когда их размер известен только во время выполнения
+    struct RuntimeRing
+    {
+        int size;
+        int hist;       // максимальное смещение
+
+        int slot(int pos) const
+        {
+            return pos % size;
+        }
+    };
+
+    /// Разбор блока на тройки выбранным способом
+    /// \param data Окно истории, текущий блок и предпросмотр
+    /// \param begin Начало текущего блока
+    /// \param end Конец текущего блока
+    /// \param res Вектор троек (offs, len, ch)
+    virtual void parseBlock(const View& data, int begin, int end, vector<Node>& res)
     {
-        vector<Node*> res;       // вектор с тройками 
-        encodeLZ77(file, res);
+        RuntimeRing ring = { window, (int)histBufMax };
 
-        BitWriter bw(directory + "pack/" + fileName + ".lz77" + to_string(prevBufMax / 1024));
+        if (parse == ULTRA)
+            encodeOptimal(ring, data, begin, end, res);
+        else
+            encodeGreedy(ring, data, begin, end, res);
+    }
 
-        // Запись количества троек в файл
-        bw << (uint)res.size();
+    /// Разбор по хеш-цепочкам: head хранит последнюю позицию с данным хешем, prev - предыдущую позицию
+    /// с тем же хешем для каждой позиции окна истории
+    ///
+    /// Ленивая оценка, как в zlib: последовательности не обязаны кончаться литералом, поэтому если в одной
+    /// из следующих lazy позиций начинается более длинное совпадение, текущий символ записывается литералом.
+    /// Совпадения короче MIN_SEQUENCE_MATCH все равно записываются литералами и в оценке не участвуют
+    /// \param ring Индексация циклических массивов
+    /// \param data Окно истории, текущий блок и предпросмотр
+    /// \param begin Начало текущего блока
+    /// \param length Конец текущего блока
+    /// \param res Вектор троек (offs, len, ch)
+    template <class Ring>
+    void encodeGreedy(const Ring& ring, const View& data, int begin, int length, vector<Node>& res)
+    {
+        Node next(0, 0, 0);     // совпадение, уже найденное для одной из следующих позиций
+        int nextPos = -1;
 
-        // Запись троек
-        for (int i = 0; i < res.size(); i++)
+        for (int i = begin; i < length; )
         {
-            bw << res[i]->offs;
-            bw << res[i]->len;
-            bw << res[i]->ch;
+            Node node = nextPos == i ? next : sequenceMatch(ring, data, i, length);
+
+            // Совпадение в позиции i + d выгоднее, если кончается дальше текущего: d литералов перед ним
+            // окупаются, как только оно длиннее текущего хотя бы на d символов
+            bool deferred = false;
+            for (int d = 1; d <= params.lazy && node.len != 0 && (int)node.len < params.niceLength; d++)
+            {
+                if (nextPos < i + d)
+                {
+                    next = sequenceMatch(ring, data, i + d, length);
+                    nextPos = i + d;
+                }
+
+                if (nextPos == i + d && (int)next.len >= (int)node.len + d)
+                {
+                    deferred = true;
+                    break;
+                }
+            }
+
+            if (deferred || node.len == 0)
+            {
+                res.push_back(Node(0, 0, data[i]));
+                i++;
+                continue;
+            }
+
+            node.ch = data[i + node.len];
+            res.push_back(node);
+
+            i += node.len + 1;
         }
+    }
+
+    /// Совпадение, которое запишется совпадением, а не литералами
+    /// \return Тройка со смещением и длиной совпадения не короче MIN_SEQUENCE_MATCH или тройка нулевой длины
+    template <class Ring>
+    Node sequenceMatch(const Ring& ring, const View& data, int pos, int length)
+    {
+        Node node = matchAt(ring, data, pos, length);
+        if ((int)node.len < MIN_SEQUENCE_MATCH)
+            return Node(0, 0, 0);
 
-		// Определение коэффицента сжатия
-		file.clear();
-		file.seekg(0, file.end);
-		compression = file.tellg() / (double)bw.getFileSize();
-		file.seekg(0, file.beg);
-        
-        // Очистка памяти
-        bw.close();
-        for (auto i : res)
-            delete i;
-        res.clear();
+        return node;
     }
 
-    void unpack(string directory, string fileName)
+    /// Поиск совпадения для позиции: сначала в хеш-цепочки добавляются все предыдущие позиции
+    /// \param length Конец текущего блока
+    /// \return Тройка со смещением и длиной совпадения (символ после совпадения не заполняется)
+    template <class Ring>
+    Node matchAt(const Ring& ring, const View& data, int pos, int length)
     {
-        // Считывание входных данных
-        BitReader br(directory + "pack/" + fileName + ".lz77" + to_string(prevBufMax / 1024));
+        if (pos >= length)
+            return Node(0, 0, 0);
+
+        insertPositions(ring, data, pos);
 
-        uint lenght;
-        br >> lenght;
+        // После совпадения всегда записывается следующий символ, поэтому совпадение не доходит до конца блока
+        int maxLen = length - pos - 1;
+        if (maxLen > (int)maxMatch)
+            maxLen = maxMatch;
 
-        Node* res = new Node[lenght];
-        for (int i = 0; i < lenght; i++)
+        return findMatch(ring, data, pos, maxLen);
+    }
+
+    /// Добавление в хеш-цепочки всех позиций до pos
+    template <class Ring>
+    void insertPositions(const Ring& ring, const View& data, int pos)
+    {
+        for (; inserted < pos && inserted + MIN_MATCH <= (int)data.size(); inserted++)
         {
-            br >> res[i].offs;
-            br >> res[i].len;
-            br >> res[i].ch;
+            unsigned int h = hash(&data[inserted]);
+            prev[ring.slot(inserted)] = head[h];
+            head[h] = inserted;
         }
+    }
+
+    /// Ищет самое длинное совпадение для текущей позиции среди позиций с тем же хешем
+    /// Позиции, добавленные в цепочки при заглядывании вперед, пропускаются
+    /// \param data Окно истории, текущий блок и предпросмотр
+    /// \param pos Текущая позиция
+    /// \param maxLen Максимальная длина совпадения
+    /// \return Тройка со смещением и длиной совпадения (символ после совпадения не заполняется)
+    template <class Ring>
+    Node findMatch(const Ring& ring, const View& data, int pos, int maxLen)
+    {
+        Node best(0, 0, 0);
+        if (maxLen < MIN_MATCH)
+            return best;
+
+        const char* cur = &data[pos];
+        int candidate = head[hash(cur)];
+
+        for (int chain = params.maxChain; candidate >= 0 && pos - candidate <= ring.hist && chain > 0; chain--)
+        {
+            const char* match = &data[candidate];
+
+            // Сначала сравнивается символ, на котором закончилось лучшее совпадение
+            if (candidate < pos && match[best.len] == cur[best.len])
+            {
+                int len = extendMatch(match, cur, 0, maxLen);
+
+                if ((uint)len > best.len)
+                {
+                    best.offs = (uint)(pos - candidate);
+                    best.len = (uint)len;
 
-        // Готовим файл для записи раскодированного сообщения
-        ofstream encodeFile;
-        encodeFile.open(directory + "unpack/" + fileName + ".unlz77" + to_string(prevBufMax / 1024), ios::binary);
+                    if (len >= params.niceLength || len == maxLen)
+                        break;
+                }
+            }
 
-        decodeLZ77(res, lenght, encodeFile);
+            candidate = prev[ring.slot(candidate)];
+        }
 
-        br.close();
-        encodeFile.close();
-        delete[] res;
+        return best;
     }
 
-    double getCompression()
+    /// Оптимальный разбор: для каждой позиции известна наименьшая стоимость кодирования блока до нее,
+    /// из каждой позиции перебираются все тройки, которые можно в ней начать
+    ///
+    /// Дерево строится по всем прочитанным данным, включая предпросмотр за блоком: если бы длины сравнений
+    /// обрезались на конце блока, порядок строк в дереве нарушился бы. На конце блока обрезаются только
+    /// длины совпадений, из которых выбирается разбор. Строки в дереве сравниваются не дальше TREE_LENGTH
+    /// символов, совпадение длиннее NICE_LENGTH продолжается сравнением и берется сразу, а позиции внутри
+    /// него только добавляются в дерево - иначе на повторяющихся данных разбор стал бы квадратичным
+    /// \param ring Индексация циклических массивов
+    /// \param data Окно истории, текущий блок и предпросмотр
+    /// \param begin Начало текущего блока
+    /// \param length Конец текущего блока
+    /// \param res Вектор троек (offs, len, ch)
+    template <class Ring>
+    void encodeOptimal(const Ring& ring, const View& data, int begin, int length, vector<Node>& res)
     {
-        return compression;
+        int size = length - begin;
+
+        vector<unsigned int> price(size + 1, UINT_MAX);     // стоимость кодирования начала блока в битах
+        vector<Node> last(size + 1);                        // последняя тройка самого дешевого разбора
+        vector<Match> matches;
+
+        price[0] = 0;
+
+        for (int i = begin; i < length; i++)
+        {
+            findMatches(ring, data, i, treeLength(data, i), matches);
+
+            int maxLen = length - i - 1;
+            if (maxLen > (int)maxMatch)
+                maxLen = maxMatch;
+
+            // Длинное совпадение продолжается за TREE_LENGTH и берется без перебора
+            if (!matches.empty() && matches.back().len >= NICE_LENGTH)
+            {
+                Match m = matches.back();
+                const char* cur = &data[i];
+                if (m.len < maxLen)
+                    m.len = extendMatch(cur - m.offs, cur, m.len, maxLen);
+
+                if (m.len > maxLen)
+                    m.len = maxLen;
+
+                relax(price, last, i - begin, m.offs, m.len);
+
+                // Позиции внутри совпадения только добавляются в дерево
+                for (int j = i + 1; j <= i + m.len; j++)
+                    findMatches(ring, data, j, treeLength(data, j), matches);
+
+                i += m.len;
+                continue;
+            }
+
+            // Тройка без совпадения, затем все длины совпадений: для каждой длины берется самое близкое смещение
+            relax(price, last, i - begin, 0, 0);
+
+            int prevLen = 0;
+            for (const Match& m : matches)
+            {
+                int matchLen = m.len < maxLen ? m.len : maxLen;
+
+                for (int len = prevLen + 1; len <= matchLen; len++)
+                    relax(price, last, i - begin, m.offs, len);
+
+                if (m.len >= maxLen)
+                    break;
+
+                prevLen = m.len;
+            }
+        }
+
+        // Восстановление разбора с конца блока
+        size_t first = res.size();
+        for (int end = size; end > 0; end -= last[end].len + 1)
+            res.push_back(Node(last[end].offs, last[end].len, data[begin + end - 1]));
+
+        reverse(res.begin() + first, res.end());
     }
 
-    string getName()
+    /// Обновление стоимости позиции, в которой заканчивается тройка (позиции отсчитываются от начала блока)
+    void relax(vector<unsigned int>& price, vector<Node>& last, int pos, int offs, int len)
     {
-        return "LZ77(" + to_string(histBufMax / 1024) + ", " + to_string(prevBufMax / 1024) + ")";
+        int end = pos + len + 1;
+        unsigned int p = price[pos] + tokenCost(len);
+
+        if (p < price[end])
+        {
+            price[end] = p;
+            last[end] = Node((uint)offs, (uint)len, 0);
+        }
     }
 
-    /// \param histBufMax Максимальный размер буфера предыстории (словаря) в килобайтах
-    /// \param prefBufMax Максимальный размер буфера предпросмотра (скользящего окна) в килобайтах
-    LZ77(int histBufMax, int prevBufMax)
+    /// Стоимость тройки в битах: короткое совпадение стоит как литералы, длинное - как токен, смещение
+    /// и продолжение длины. Символ после совпадения считается литералом (стоимость токена для отрезка
+    /// литералов не учитывается). Смещение всегда занимает offsetBytes байт и на выбор не влияет
+    unsigned int tokenCost(int len) const
     {
-        this->histBufMax = histBufMax * 1024;
-        this->prevBufMax = prevBufMax * 1024;
+        if (len < MIN_SEQUENCE_MATCH)
+            return 8 * (len + 1);
+
+        int rest = len - MIN_SEQUENCE_MATCH;
+        int extra = rest >= 15 ? (rest - 15) / 255 + 1 : 0;
+
+        return 8 * (1 + offsetBytes + extra + 1);
     }
 
-private:
-    LZ77();     // констуруктор по умолчанию запрещен
-    class Node;
+    /// Длина сравнения строк в двоичном дереве для позиции
+    int treeLength(const View& data, int pos) const
+    {
+        int len = (int)data.size() - pos - 1;
+        int limit = (int)maxMatch < TREE_LENGTH ? (int)maxMatch : TREE_LENGTH;
 
-    /// Кодирует строку по LZ77 алгоритму
-    /// \param s Исходная файл
-    /// \param res Вектор троек (offs, len, ch)
-    void encodeLZ77(ifstream& s, vector<Node*>& res)
+        return len < limit ? len : limit;
+    }
+
+    /// Добавление позиции в двоичное дерево и поиск всех совпадений с ней
+    /// Дерево для каждого хеша упорядочивает позиции окна по строкам, которые с них начинаются. Спуск по дереву
+    /// проходит через ближайшие по содержимому строки, поэтому находятся совпадения всех длин
+    /// \param data Окно истории, текущий блок и предпросмотр
+    /// \param pos Текущая позиция
+    /// \param maxLen Максимальная длина сравнения строк (одинаковая для всех позиций, кроме конца файла)
+    /// \param matches Найденные совпадения по возрастанию длины
+    template <class Ring>
+    void findMatches(const Ring& ring, const View& data, int pos, int maxLen, vector<Match>& matches)
     {
-        // Создание кольцевого буфера
-        Buffer charBuff(histBufMax, prevBufMax);
+        matches.clear();
+        if (pos + MIN_MATCH > (int)data.size())
+            return;
 
-        // Получение длины файла
-		s.clear();
-        s.seekg(0, s.end);
-        int length = s.tellg();
-        s.seekg(0, s.beg);
+        unsigned int h = hash(&data[pos]);
+        int candidate = head[h];
+        head[h] = pos;
 
-        char ch;
+        const char* cur = &data[pos];
+        int* less = &son[2 * ring.slot(pos)];           // куда подвешивается следующая позиция со строкой меньше текущей
+        int* greater = &son[2 * ring.slot(pos) + 1];    // и больше текущей
+        int lessLen = 0, greaterLen = 0;
+        int bestLen = 0;
 
-        // Заполнение буфера
-        int max = length < histBufMax + prevBufMax ? length : histBufMax + prevBufMax;
-        for (int i = 0; i < max; i++)
+        for (int depth = params.maxChain; ; depth--)
         {
-            s.get(ch);
-            charBuff.addChar(ch);
-        }
+            if (candidate < 0 || pos - candidate > ring.hist || depth == 0)
+            {
+                *less = *greater = -1;
+                break;
+            }
 
-        for (int i = 0; i < length; i++)
-        {
-            Node* newNode = findSubString(charBuff, i, i < histBufMax ? i : histBufMax, length - i < prevBufMax ? length : prevBufMax);
-            res.push_back(newNode);
-            
-            if (i >= histBufMax + prevBufMax)
+            int* pair = &son[2 * ring.slot(candidate)];
+            const char* match = &data[candidate];
+
+            // Общее начало с обоими ограничивающими узлами уже известно
+            // Большинство кандидатов расходится сразу, поэтому первый символ проверяется до вызова
+            int len = lessLen < greaterLen ? lessLen : greaterLen;
+            if (len < maxLen && match[len] == cur[len])
+                len = extendMatch(match, cur, len + 1, maxLen);
+
+            if (len > bestLen)
             {
-                for (int j = 0; j <= newNode->len; j++)
-                {
-                    s.get(ch);
-                    charBuff.addChar(ch);
-                }
+                bestLen = len;
+                matches.push_back(Match{ len, pos - candidate });
+            }
+
+            // Строки совпали целиком: поддеревья кандидата переходят текущей позиции
+            if (len == maxLen)
+            {
+                *less = pair[0];
+                *greater = pair[1];
+                break;
             }
 
-            i += newNode->len;
+            if ((unsigned char)match[len] < (unsigned char)cur[len])
+            {
+                *less = candidate;
+                less = &pair[1];
+                candidate = *less;
+                lessLen = len;
+            }
+            else
+            {
+                *greater = candidate;
+                greater = &pair[0];
+                candidate = *greater;
+                greaterLen = len;
+            }
         }
     }
 
-    /// Ищет подстроку максимальной длины в буферах предыстории и предпросмотра
-    /// \param str вся строка
-    /// \param curPos текущая позиция в строке
-    /// \param curHS текущая длина  буфера истории
-    /// \param curPS текущая длина буфера просмотра
-    /// \return узел с первой позицией вхождения подстроки, ее длиной и символом после
-    Node* findSubString(Buffer& str, uint curPos, usint sizeHB, usint sizePB)
+    /// Начальное состояние поиска совпадений: пустые хеш-цепочки или пустое двоичное дерево
+    /// Очищается только то, что понадобится для size байт: для небольших данных хеш-таблица берется меньше,
+    /// а в циклических массивах - только ячейки позиций данных (остальные не читаются, пока не записаны)
+    /// \param size Размер исходных данных (SIZE_MAX, если он неизвестен)
+    void resetMatcher(size_t size)
     {
-        uint* br = new uint[sizePB + sizeHB + 1];
-        for (int i = 0; i < sizePB + 1; i++)
-            br[i] = 0;
+        // Корзин незачем брать больше, чем позиций в данных: хеш не входит в формат файла
+        hashBits = windowHashBits;
+        while (hashBits > SMALL_HASH_BITS && (size_t)1 << (hashBits - 1) >= size)
+            hashBits--;
 
-        int max = 0;
-        int meet = 0;
+        head.assign((size_t)1 << hashBits, -1);
 
-        // Заполнение массива граней, i - первоначальная длина буфера просмотра + 0 символов буфера истории; +1; +2 ...
-        // То есть количество итераций будет равно длине буфера истории
-        for (int i = sizePB - 1; i < sizePB + sizeHB - 1; i++)
+        // Массивы больше окна, чтобы новая позиция не занимала место самой старой
+        size_t used = min((size_t)window, size);
+        if (parse == ULTRA)
+        {
+            son.resize(2 * (size_t)window);
+            fill(son.begin(), son.begin() + 2 * used, -1);
+        }
+        else
         {
-            setBoorderSize(str, br, i, i + 1, curPos, sizeHB, sizePB);
+            prev.resize(window);
+            fill(prev.begin(), prev.begin() + used, -1);
+        }
 
-            if (br[i + 1] > max)
-            {
-                max = br[i + 1];
-                meet = sizeHB + sizePB + max - (i + 2);
-            }
+        inserted = 0;
+    }
+
+    /// Сдвиг окна после блока: от начала отбрасывается кратное window число байт, так что перед концом
+    /// блока остается не меньше histBufMax байт истории, а позиции в циклических массивах не меняют своих мест
+    /// \param data Окно истории, закодированный блок и предпросмотр
+    /// \param end Конец закодированного блока
+    /// \return На сколько байт сдвинуто окно
+    int slideWindow(View& data, int end)
+    {
+        int shift = end > (int)histBufMax ? (end - (int)histBufMax) / window * window : 0;
+        if (shift == 0)
+            return 0;
+
+        data.base += shift;
+        data.length -= shift;
+
+        // Позиции отсчитываются от нового начала, вышедшие из окна позиции удаляются
+        for (vector<int>* positions : { &head, &prev, &son })
+        {
+            for (int& p : *positions)
+                p = p >= shift ? p - shift : -1;
         }
 
-        delete[] br;
-        return new Node(meet, max, str.getChar(curPos + max));
+        inserted = inserted > shift ? inserted - shift : 0;
+
+        return shift;
     }
 
-    /// Устанавливает значения граней для строки prew|hist
-    /// \param br массив со значениями длин граней
-    /// \param currentInd длина текущей подстроки
-    /// \param lastInd индекс последнего символа
-    void setBoorderSize(Buffer& str, uint* br, uint currentInd, uint lastInd, uint curPos, usint sizeHB, usint sizePB)
+    /// Дочитывание потока в буфер кодера
+    /// \param input Исходные данные (поток)
+    /// \param buffer Окно истории, текущий блок и предпросмотр
+    /// \param needed Нужный размер буфера (меньше только в конце потока)
+    static void fillBuffer(InputSource& input, vector<char>& buffer, size_t needed)
     {
-        if (str.getChar(getIndex(lastInd, curPos, sizeHB, sizePB)) == str.getChar(getIndex(br[currentInd], curPos, sizeHB, sizePB)))
-            br[lastInd] = br[currentInd] + 1;
-        else
+        while (buffer.size() < needed)
         {
-            if (br[currentInd] == 0)    // в подстроке уже нет граней
-                br[lastInd] = 0;
-            else
-                setBoorderSize(str, br, br[currentInd - 1], lastInd, curPos, sizeHB, sizePB);
+            const char* chunk;
+            size_t count = input.read(chunk, needed - buffer.size());
+            if (count == 0)
+                break;
+
+            buffer.insert(buffer.end(), chunk, chunk + count);
         }
     }
 
-    /// Получает верный индекс в строке. Рассчитывает смещение
-    /// \param ind индекс в измененной строке: prew|hist
-    int getIndex(uint ind, uint curPos, usint sizeHB, usint sizePB)
+    /// Хеш первых MIN_MATCH символов
+    unsigned int hash(const char* p) const
+    {
+        unsigned int v = (unsigned char)p[0] | ((unsigned char)p[1] << 8) | ((unsigned char)p[2] << 16);
+        return (v * 2654435761u) >> (32 - hashBits);
+    }
+
+    /// Запись блока: размер исходного блока, размер последовательностей, последовательности
+    /// \param data Окно истории, текущий блок и предпросмотр
+    /// \param begin Начало текущего блока
+    /// \param end Конец текущего блока
+    /// \param res Разбор блока на тройки
+    /// \param bw Поток для записи
+    virtual void writeBlock(const View& data, int begin, int end, const vector<Node>& res, BitWriter& bw)
     {
-        int currentInd;
+        sequences.clear();
+        writeSequences(data, begin, res, sequences);
 
-        if (ind < sizePB) currentInd = ind + curPos;
-        else currentInd = ind + curPos - (sizeHB + sizePB);
+        bw << (uint)(end - begin) << (uint)sequences.size();
+        bw.writeBytes(sequences.data(), sequences.size());
+    }
 
-        return currentInd;
+    /// Запись признака конца файла - блока нулевого размера
+    virtual void writeEnd(BitWriter& bw)
+    {
+        bw << (uint)0;
     }
 
-    /// Декодер
-    void decodeLZ77(Node* arr, uint n, ofstream& res)
+    /// Чтение заголовка блока
+    /// \return Размер исходного блока (0 - конец файла)
+    virtual uint readBlockHeader(BitReader& br)
     {
-        // Создание кольцевого буфера
-        Buffer charBuf(histBufMax, prevBufMax);
+        uint size;
+        br >> size;
 
-        for (int i = 0; i < n; i++)
+        return size;
+    }
+
+    /// Декодирование блока
+    /// \param br Поток закодированного сообщения
+    /// \param out Куда записывается блок (перед ним лежит окно истории)
+    /// \param size Размер исходного блока
+    /// \return false, если блок поврежден
+    virtual bool decodeBlock(BitReader& br, char* out, uint size)
+    {
+        uint packed;
+        br >> packed;
+
+        // Последовательность с совпадением не длиннее самого совпадения в полтора раза, поэтому больший размер
+        // означает поврежденный заголовок, под который не стоит выделять память
+        if (packed > 2 * (size_t)size + 16)
+            return false;
+
+        sequences.resize(packed + COPY_SLACK);
+        br.readBytes(sequences.data(), packed);
+        if (!br)
+            return false;
+
+        return decodeLZ77(sequences, packed, history, out, size);
+    }
+
+    /// Запись разбора последовательностями: отрезок литералов, затем совпадение
+    /// \param data Окно истории, текущий блок и предпросмотр
+    /// \param begin Начало текущего блока
+    /// \param triples Разбор блока на тройки
+    /// \param out Куда записываются последовательности
+    void writeSequences(const View& data, size_t begin, const vector<Node>& triples, vector<char>& out)
+    {
+        size_t literals = begin;    // начало текущего отрезка литералов
+        size_t pos = begin;
+
+        for (const Node& t : triples)
         {
-            int end = charBuf.sum - arr[i].offs + arr[i].len;
-            for (int j = charBuf.sum - arr[i].offs; j < end; j++)
+            if (t.len >= MIN_SEQUENCE_MATCH)
             {
-                charBuf.addChar(charBuf.getChar(j));
-                res<<charBuf.getChar(j);
+                writeSequence(data, literals, pos - literals, t.offs, t.len, out);
+                literals = pos + t.len;
             }
 
-            charBuf.addChar(arr[i].ch);
-            res << arr[i].ch;
+            // Символ после совпадения (и короткое совпадение) попадают в следующий отрезок литералов
+            pos += t.len + 1;
         }
+
+        // Последняя последовательность состоит только из литералов
+        writeSequence(data, literals, pos - literals, 0, 0, out);
     }
 
-private:
-    usint histBufMax, prevBufMax;
+    /// Запись одной последовательности
+    /// \param first Начало отрезка литералов
+    /// \param count Количество литералов
+    /// \param offs Смещение совпадения
+    /// \param len Длина совпадения (0 - последняя последовательность без совпадения)
+    void writeSequence(const View& data, size_t first, size_t count, uint offs, uint len, vector<char>& out)
+    {
+        size_t matchCode = len != 0 ? len - MIN_SEQUENCE_MATCH : 0;
+
+        out.push_back((char)(((count < 15 ? count : 15) << 4) | (matchCode < 15 ? matchCode : 15)));
+        if (count >= 15)
+            writeLength(count - 15, out);
+
+        out.insert(out.end(), data.begin() + first, data.begin() + first + count);
+
+        if (len == 0)
+            return;
+
+        // Смещение - offsetBytes байт, младший первым
+        for (int i = 0; i < offsetBytes; i++)
+            out.push_back((char)(offs >> (8 * i)));
+
+        if (matchCode >= 15)
+            writeLength(matchCode - 15, out);
+    }
+
+    /// Продолжение длины: байты 255, пока остаток не меньше 255, затем остаток
+    void writeLength(size_t rest, vector<char>& out)
+    {
+        for (; rest >= 255; rest -= 255)
+            out.push_back((char)255);
+
+        out.push_back((char)rest);
+    }
+
+    /// Чтение продолжения длины, не дальше конца последовательностей
+    static size_t readLength(const unsigned char*& in, const unsigned char* inEnd)
+    {
+        size_t len = 0;
+        unsigned char b;
+
+        do
+        {
+            if (in == inEnd)
+                break;
+
+            b = *in++;
+            len += b;
+        } while (b == 255);
+
+        return len;
+    }
+
+    /// Декодер последовательностей
+    /// Литералы и совпадения копируются порциями по 16 байт и могут записать до COPY_SLACK байт за концом
+    /// блока, поэтому после блока и после последовательностей в буферах оставляется запас
+    /// \param sequences Записанные последовательности блока
+    /// \param packed Размер последовательностей (за ними в sequences лежит запас)
+    /// \param start Начало раскодированных данных, на которые могут ссылаться совпадения
+    /// \param out Куда записывается блок (перед ним лежит окно истории)
+    /// \param size Размер исходного блока
+    /// \return false, если последовательности повреждены: литералы или совпадение выходят за конец блока,
+    /// совпадение ссылается раньше начала данных или последовательности кончились раньше блока
+    bool decodeLZ77(const vector<char>& sequences, size_t packed, const char* start, char* out, size_t size)
+    {
+        const unsigned char* in = (const unsigned char*)sequences.data();
+        const unsigned char* inEnd = in + packed;
+        char* outEnd = out + size;
+        unsigned int offsetMask = offsetBytes == 4 ? 0xFFFFFFFF : (1u << (8 * offsetBytes)) - 1;
+
+        while (true)
+        {
+            if (in == inEnd)
+                return false;
+
+            unsigned int token = *in++;
+
+            // Литералы
+            size_t count = token >> 4;
+            if (count == 15)
+                count += readLength(in, inEnd);
+
+            if (count > (size_t)(outEnd - out) || count > (size_t)(inEnd - in))
+                return false;
+
+            if (count >= 15)
+                wildCopy(out, (const char*)in, out + count);
+            else
+                memcpy(out, in, 16);    // короткий отрезок копируется одной порцией
+
+            in += count;
+            out += count;
+
+            if (out == outEnd)
+                return in == inEnd;
+
+            // Совпадение
+            // Читаются всегда 4 байта (в конце последовательностей есть запас), лишние отбрасываются маской
+            if (offsetBytes > inEnd - in)
+                return false;
+
+            unsigned int offs = (in[0] | (in[1] << 8) | (in[2] << 16) | ((unsigned int)in[3] << 24)) & offsetMask;
+            in += offsetBytes;
+
+            size_t len = token & 15;
+            if (len == 15)
+                len += readLength(in, inEnd);
+            len += MIN_SEQUENCE_MATCH;
+
+            if (len > (size_t)(outEnd - out) || offs == 0 || offs > (size_t)(out - start))
+                return false;
+
+            copyMatch(out, offs, len);
+            out += len;
+        }
+    }
+
+    /// Копирование порциями по 16 байт, последняя порция может выйти за конец на 15 байт
+    /// \param dst Куда копировать
+    /// \param src Откуда копировать (не ближе 16 байт перед dst)
+    /// \param dstEnd Конец копируемого отрезка
+    static void wildCopy(char* dst, const char* src, char* dstEnd)
+    {
+        do
+        {
+            memcpy(dst, src, 16);
+            dst += 16;
+            src += 16;
+        } while (dst < dstEnd);
+    }
+
+    /// Копирование совпадения из уже раскодированной части, может записать до COPY_SLACK байт за концом совпадения
+    /// \param out Куда копируется совпадение
+    /// \param offs Смещение совпадения
+    /// \param len Длина совпадения
+    static void copyMatch(char* out, unsigned int offs, size_t len)
+    {
+        const char* src = out - offs;
+        char* end = out + len;
+
+        if (offs >= 16)
+        {
+            wildCopy(out, src, end);
+            return;
+        }
+
+        if (offs < 8)
+        {
+            // Первые 8 байт копируются по одному, затем источник отодвигается на кратное offs расстояние
+            // не меньше 8 байт: повторяющийся шаблон дальше копируется без перекрытия
+            for (int i = 0; i < 8; i++)
+                out[i] = src[i];
+
+            out += 8;
+            src = out - offs * ((8 + offs - 1) / offs);
+        }
+
+        for (; out < end; out += 8, src += 8)
+            memcpy(out, src, 8);
+    }
+
+    uint histBufMax, prevBufMax;
+    uint maxMatch;              // максимальная длина совпадения
+    int offsetBytes;            // количество байт смещения в последовательности
+    int windowHashBits;         // ширина хеш-таблицы для всего окна
+    int hashBits;               // ширина хеш-таблицы для текущего файла
+    MatchLength::Function extendMatch;      // сравнение строк, выбранное по возможностям процессора
+    int level;
+    Level params;
+    ParseMode parse;
+
+    int window;                 // размер циклических массивов prev и son (больше histBufMax)
+    vector<int> head, prev;     // хеш-цепочки, позиции отсчитываются от начала окна
+    vector<int> son;            // двоичное дерево для оптимального разбора (head - корни деревьев)
+    int inserted;               // позиции до inserted уже добавлены в хеш-цепочки
+    vector<char> sequences;     // последовательности текущего блока
+    const char* history;        // начало раскодированных данных, на которые могут ссылаться совпадения блока
 	double compression;
 
     /// Вспомогательный класс, представляет из себя узел  
     class Node
     {
     public:
-        usint offs;
-        usint len;
+        uint offs;
+        uint len;
         char ch;
 
-        Node(usint o, usint l, char c) : offs(o), len(l), ch(c)
+        Node(uint o, uint l, char c) : offs(o), len(l), ch(c)
         {};
 
         Node()
@@ -4,35 +4,104 @@
 // Сделано: все кодировки, тестировщик, замеряющий время, bitreader и bitwriter
 // Не сделано: LZW кодировка
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <new>
+#include <sstream>
+#include <vector>
 
 #include "fileStreams.h"
 #include "IEncoder.h"
 #include "haffman.h"
+#include "adaptiveHuffman.h"
 #include "shennonFano.h"
 #include "lz77.h"
+#include "deflate.h"
+#include "fixedLZ77.h"
 #include "frequancyEntropy.h"
 
 using namespace std;
 
 LARGE_INTEGER fr;
+atomic<unsigned long long> allocations(0);     // количество выделений динамической памяти
 unsigned int testTimePack(IEncoder* ob, ifstream& a, string b, string c);
 unsigned int testTimeUnpack(IEncoder* ob, string b, string c);
+bool sameFiles(string a, string b);
+unsigned long long fileSize(string path);
+bool memoryRoundTrip(IEncoder* ob, string path);
+bool rejectsDamaged(IEncoder* ob, string path);
+bool rejectsWrappedCounts();
+
+/// Подсчет выделений памяти, чтобы сравнивать кодировки не только по времени
+void* operator new(size_t size)
+{
+    allocations++;
+
+    void* p = malloc(size != 0 ? size : 1);
+    if (p == nullptr)
+        throw bad_alloc();
+
+    return p;
+}
+
+// GCC, встроив operator delete в вызывающий код, видит free для указателя из operator new и считает
+// их несовместимыми, хотя operator new выше выделяет память через malloc
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
 
 
 int main()
 {
     // Объекты для кодировок
-    IEncoder* code[5] = { new ShannonFano(), new Huffman(), new LZ77(4, 5), new LZ77(8, 10), new LZ77(16, 20) };
+    vector<IEncoder*> code = { new ShannonFano(), new Huffman(Huffman::TREE), new Huffman(), new Huffman(Huffman::TABLE, Huffman::FOUR_STREAMS),
+        new Huffman(Huffman::TABLE, Huffman::SINGLE_STREAM, 4, 64), new ShannonFano(4, 64), new AdaptiveHuffman(), new LZ77(4, 5),
+        new LZ77(8, 10), new LZ77(16, 20, 9, LZ77::ULTRA), new Deflate(32, 32), new Deflate(32, 32, 9, LZ77::ULTRA),
+        new LZ77(4096, 256), new Deflate(4096, 256), new FixedLZ77<4, 5>(), new FixedLZ77<8, 10>(), new FixedLZ77<16, 20>() };
+
+    // Все уровни сжатия LZ77
+    size_t firstLevel = code.size();
+    for (int level = 1; level <= 9; level++)
+        code.push_back(new LZ77(16, 20, level));
+
     FrequancyEntropy frEn;
 
+    vector<string> names;
+    for (IEncoder* ob : code)
+        names.push_back(ob->getName());
+
     // Подготовка файлов
     ifstream fInput;
-    FileStreams results;
+    FileStreams results(names);
 
     string basicPath = "../resourses/";
     string fileName;
+    int failures = 0;
+    unsigned long long levelSize = 0;     // размер файла, упакованного предыдущим уровнем LZ77
     QueryPerformanceFrequency(&fr);  // замер частоты процессора
+
+    // Заголовок Шенона-Фано, сумма частот в котором переполняет 64 бита, распаковка должна отвергнуть
+    if (rejectsWrappedCounts())
+        cout << "Shannon-Fano: wrapped counts are rejected" << endl << endl;
+    else
+    {
+        cout << "Shannon-Fano: wrapped counts are accepted, FAILED" << endl << endl;
+        failures++;
+    }
     
     for (int i = 1; i <= 36; i++)
     {
@@ -44,7 +113,7 @@ int main()
         results.writeFrequancyEntropy(frEn.getFrequancy(), frEn.getEntropy());
         cout << "File in process: " << fileName << endl << "Frequancy and Entropy are OK\n\n";
 
-        for (int j = 0; j < 5; j++)
+        for (size_t j = 0; j < code.size(); j++)
         {
             // Кодирование
             unsigned int time = testTimePack(code[j], fInput, basicPath, fileName);
@@ -52,12 +121,69 @@ int main()
 
             results.writePackTime(time);
             results.writeCompression(code[j]->getCompression());
+
+            // Следующий уровень LZ77 не должен упаковывать файл хуже предыдущего
+            if (j >= firstLevel)
+            {
+                unsigned long long size = fileSize(basicPath + "pack/" + fileName + "." + code[j]->getExtension());
+                if (j > firstLevel && size > levelSize)
+                {
+                    cout << '\t' << code[j]->getName() << ": packed file is larger than at the previous level, FAILED" << endl;
+                    failures++;
+                }
+
+                levelSize = size;
+            }
             
             // Декодирование
+            unsigned long long before = allocations;
             time = testTimeUnpack(code[j], basicPath, fileName);
-            cout << '\t' << code[j]->getName() << ": decoding is OK" << endl;
+
+            // Распакованный файл должен совпасть с исходным байт в байт
+            if (sameFiles(basicPath + fileName, basicPath + "unpack/" + fileName + ".un" + code[j]->getExtension()))
+                cout << '\t' << code[j]->getName() << ": decoding is OK" << endl;
+            else
+            {
+                cout << '\t' << code[j]->getName() << ": decoding FAILED" << endl;
+                failures++;
+            }
 
             results.writeUnpackTime(time);
+            results.writeAllocations(allocations - before);
+
+            // Тот же файл, упакованный и распакованный в памяти
+            if (memoryRoundTrip(code[j], basicPath + fileName))
+                cout << '\t' << code[j]->getName() << ": memory round trip is OK" << endl;
+            else
+            {
+                cout << '\t' << code[j]->getName() << ": memory round trip FAILED" << endl;
+                failures++;
+            }
+
+            // Оборванный архив распаковка должна отвергнуть, а не выдать неполный файл за целый
+            if (rejectsDamaged(code[j], basicPath + fileName))
+                cout << '\t' << code[j]->getName() << ": damaged input is rejected" << endl;
+            else
+            {
+                cout << '\t' << code[j]->getName() << ": damaged input is accepted, FAILED" << endl;
+                failures++;
+            }
+
+            // Тот же файл в конвейерном режиме: файлы пишутся и читаются в отдельных потоках выполнения
+            code[j]->setPipelined(true);
+            unsigned int packTime = testTimePack(code[j], fInput, basicPath, fileName);
+            time = testTimeUnpack(code[j], basicPath, fileName);
+            code[j]->setPipelined(false);
+
+            if (sameFiles(basicPath + fileName, basicPath + "unpack/" + fileName + ".un" + code[j]->getExtension()))
+                cout << '\t' << code[j]->getName() << ": pipelined round trip is OK" << endl;
+            else
+            {
+                cout << '\t' << code[j]->getName() << ": pipelined round trip FAILED" << endl;
+                failures++;
+            }
+
+            results.writePipelinedTime(packTime, time);
 
             cout << endl;
         }
@@ -67,7 +193,10 @@ int main()
         fInput.close();
     }
  
-    return 0;
+    if (failures != 0)
+        cout << "Failed round trips: " << failures << endl;
+
+    return failures == 0 ? 0 : 1;
 }
 
 
@@ -111,4 +240,113 @@ unsigned int testTimeUnpack(IEncoder* ob, string b, string c)
     t.QuadPart /= 1;
 
     return (unsigned int)((t.QuadPart * 1000000 / fr.QuadPart));
+}
+
+/// Побайтовое сравнение двух файлов
+/// \param a Путь до первого файла
+/// \param b Путь до второго файла
+/// \return true, если файлы открылись и совпадают
+bool sameFiles(string a, string b)
+{
+    ifstream first(a, ios::binary), second(b, ios::binary);
+    if (!first || !second)
+        return false;
+
+    const size_t BLOCK_SIZE = 1 << 20;
+    vector<char> x(BLOCK_SIZE), y(BLOCK_SIZE);
+
+    while (true)
+    {
+        first.read(x.data(), BLOCK_SIZE);
+        second.read(y.data(), BLOCK_SIZE);
+
+        streamsize count = first.gcount();
+        if (count != second.gcount() || !equal(x.begin(), x.begin() + count, y.begin()))
+            return false;
+
+        if (count == 0)
+            return true;
+    }
+}
+
+/// Размер файла
+/// \param path Путь до файла
+/// \return Размер в байтах (0, если файл не открылся)
+unsigned long long fileSize(string path)
+{
+    ifstream file(path, ios::binary | ios::ate);
+    return file ? (unsigned long long)file.tellg() : 0;
+}
+
+/// Упаковка и распаковка файла в памяти через все перегрузки pack и unpack для областей памяти
+/// \param ob Кодировка
+/// \param path Путь до исходного файла
+/// \return true, если распакованные данные совпали с файлом, а упаковка в буфер - с упаковкой в массив
+bool memoryRoundTrip(IEncoder* ob, string path)
+{
+    ifstream file(path, ios::binary);
+    vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    vector<uint8_t> packed, unpacked;
+    ob->pack(data.data(), data.size(), packed);
+    if (!ob->unpack(packed.data(), packed.size(), unpacked) || unpacked != data)
+        return false;
+
+    // Буферы вызывающего ровно нужного размера
+    vector<uint8_t> packedBuffer(packed.size()), unpackedBuffer(data.size());
+    if (ob->pack(data.data(), data.size(), packedBuffer.data(), packedBuffer.size()) != packed.size() || packedBuffer != packed)
+        return false;
+
+    size_t length;
+    return ob->unpack(packedBuffer.data(), packedBuffer.size(), unpackedBuffer.data(), unpackedBuffer.size(), length)
+        && length == data.size() && unpackedBuffer == data;
+}
+
+/// Распаковка оборванных архивов: пустого, половины архива и архива без последнего байта
+/// \param ob Кодировка
+/// \param path Путь до исходного файла
+/// \return true, если каждая такая распаковка сообщила об ошибке и выдала не больше, чем начало файла
+bool rejectsDamaged(IEncoder* ob, string path)
+{
+    ifstream file(path, ios::binary);
+    vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    vector<uint8_t> packed, unpacked;
+    ob->pack(data.data(), data.size(), packed);
+
+    for (size_t size : { (size_t)0, packed.size() / 2, packed.size() - 1 })
+    {
+        if (ob->unpack(packed.data(), size, unpacked))
+            return false;
+
+        if (unpacked.size() > data.size() || !equal(unpacked.begin(), unpacked.end(), data.begin()))
+            return false;
+    }
+
+    return true;
+}
+
+/// Распаковка заголовка Шенона-Фано с 8-байтовыми частотами, сумма которых переполняет 64 бита
+/// \return true, если распаковка сообщила об ошибке
+bool rejectsWrappedCounts()
+{
+    ostringstream out;
+    BitWriter bw(out);
+
+    // Ширина, признаки 234 встречающихся символов и их частоты чуть больше 2^63, затем интервал точек синхронизации
+    bw << (char)8;
+    for (int i = 0; i < 256; i++)
+        bw << (i < 234);
+
+    for (int i = 0; i < 234; i++)
+        bw << ((1ull << 63) + i);
+
+    bw << 0u;
+    bw.close();
+
+    string packed = out.str();
+    vector<uint8_t> unpacked;
+
+    ShannonFano sf;
+    return !sf.unpack((const uint8_t*)packed.data(), packed.size(), unpacked);
 }
\ No newline at end of file
@@ -0,0 +1,127 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/// Файл, отображенный в память только для чтения
+///
+/// Все проходы кодировки (подсчет частот, кодирование, размер файла) работают с одним и тем же
+/// отображением, данные не копируются в промежуточные буферы
+class MappedFile
+{
+public:
+    /// \param path Путь до файла
+    MappedFile(const string& path)
+    {
+        view = nullptr;
+        length = 0;
+        opened = false;
+
+#ifdef _WIN32
+        mapping = nullptr;
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || (unsigned long long)size.QuadPart > (size_t)-1)
+            return;
+
+        length = (size_t)size.QuadPart;
+        opened = true;
+        if (length == 0)        // пустой файл отобразить нельзя, но и читать в нем нечего
+            return;
+
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr)
+            view = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        // Без O_NONBLOCK открытие канала (FIFO) ждало бы пишущую сторону, а отобразить его все равно нельзя
+        descriptor = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+        if (descriptor == -1)
+            return;
+
+        struct stat info;
+        if (fstat(descriptor, &info) != 0 || !S_ISREG(info.st_mode))
+            return;
+
+        length = (size_t)info.st_size;
+        opened = true;
+        if (length == 0)        // пустой файл отобразить нельзя, но и читать в нем нечего
+            return;
+
+        void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address != MAP_FAILED)
+        {
+            view = (const uint8_t*)address;
+            madvise(address, length, MADV_SEQUENTIAL);     // чтение с упреждением
+        }
+#endif
+
+        opened = view != nullptr;
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (view != nullptr)
+            UnmapViewOfFile(view);
+        if (mapping != nullptr)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (view != nullptr)
+            munmap((void*)view, length);
+        if (descriptor != -1)
+            close(descriptor);
+#endif
+    }
+
+    /// \return false, если файл не удалось открыть или отобразить
+    bool isOpen() const
+    {
+        return opened;
+    }
+
+    const uint8_t* data() const
+    {
+        return view;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+private:
+    MappedFile(const MappedFile&);              // копирование запрещено
+    MappedFile& operator=(const MappedFile&);
+
+private:
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int descriptor;
+#endif
+
+    const uint8_t* view;        // начало отображения (nullptr для пустого файла)
+    size_t length;
+    bool opened;
+};
\ No newline at end of file
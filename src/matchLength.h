@@ -0,0 +1,145 @@
+﻿#pragma once
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define MATCH_LENGTH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(MATCH_LENGTH_X86) && !defined(_MSC_VER)
+#define MATCH_LENGTH_AVX2 __attribute__((target("avx2")))
+#else
+#define MATCH_LENGTH_AVX2
+#endif
+
+/// Продолжение совпадения: длина общего начала двух строк
+///
+/// Строки сравниваются по 32 (AVX2), 16 (SSE2) или 8 байт за шаг, первый несовпавший байт находится по номеру
+/// младшего единичного бита маски различий. Лучший вариант выбирается один раз по возможностям процессора
+class MatchLength
+{
+public:
+    /// Функция продолжения совпадения
+    /// \param a Первая строка
+    /// \param b Вторая строка
+    /// \param len Длина уже известного общего начала
+    /// \param maxLen Максимальная длина совпадения (за ней строки не читаются)
+    /// \return Длина общего начала, не больше maxLen
+    typedef int (*Function)(const char* a, const char* b, int len, int maxLen);
+
+    /// Самый быстрый вариант для текущего процессора
+    static Function select()
+    {
+#ifdef MATCH_LENGTH_X86
+        return hasAvx2() ? avx2 : sse2;
+#else
+        return words;
+#endif
+    }
+
+    /// Сравнение по одному байту
+    static int bytes(const char* a, const char* b, int len, int maxLen)
+    {
+        while (len < maxLen && a[len] == b[len])
+            len++;
+
+        return len;
+    }
+
+    /// Сравнение по 8 байт (порядок байт - от младшего к старшему)
+    static int words(const char* a, const char* b, int len, int maxLen)
+    {
+        for (; len + 8 <= maxLen; len += 8)
+        {
+            unsigned long long x, y;
+            memcpy(&x, a + len, 8);
+            memcpy(&y, b + len, 8);
+
+            if (x != y)
+                return len + lowestBit(x ^ y) / 8;
+        }
+
+        return bytes(a, b, len, maxLen);
+    }
+
+#ifdef MATCH_LENGTH_X86
+    /// Сравнение по 16 байт
+    static int sse2(const char* a, const char* b, int len, int maxLen)
+    {
+        for (; len + 16 <= maxLen; len += 16)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)(a + len));
+            __m128i y = _mm_loadu_si128((const __m128i*)(b + len));
+            unsigned int diff = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+
+            if (diff != 0)
+                return len + lowestBit(diff);
+        }
+
+        return words(a, b, len, maxLen);
+    }
+
+    /// Сравнение по 32 байта
+    MATCH_LENGTH_AVX2 static int avx2(const char* a, const char* b, int len, int maxLen)
+    {
+        for (; len + 32 <= maxLen; len += 32)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(a + len));
+            __m256i y = _mm256_loadu_si256((const __m256i*)(b + len));
+            unsigned int diff = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+            if (diff != 0)
+                return len + lowestBit(diff);
+        }
+
+        return sse2(a, b, len, maxLen);
+    }
+#endif
+
+private:
+    /// Номер младшего единичного бита (value != 0)
+    static int lowestBit(unsigned long long value)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return (int)index;
+#elif defined(_MSC_VER)
+        unsigned long index;
+        if (_BitScanForward(&index, (unsigned long)value))
+            return (int)index;
+        _BitScanForward(&index, (unsigned long)(value >> 32));
+        return (int)index + 32;
+#else
+        return __builtin_ctzll(value);
+#endif
+    }
+
+#ifdef MATCH_LENGTH_X86
+    /// Поддержка AVX2 процессором и операционной системой
+    static bool hasAvx2()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+
+        // AVX и сохранение регистров YMM операционной системой
+        __cpuid(info, 1);
+        if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <streambuf>
+#include <vector>
+
+using namespace std;
+
+/// Поток записи в память: в растущий массив или в буфер фиксированного размера.
+/// Байты, которые не поместились в буфер, только подсчитываются
+class MemoryOutput : public streambuf
+{
+public:
+    /// \param dst Массив, в конец которого дописываются байты
+    explicit MemoryOutput(vector<uint8_t>& dst)
+    {
+        grow = &dst;
+        fixed = nullptr;
+        capacity = 0;
+        count = 0;
+    }
+
+    /// \param dst Буфер
+    /// \param capacity Размер буфера в байтах
+    MemoryOutput(uint8_t* dst, size_t capacity)
+    {
+        grow = nullptr;
+        fixed = dst;
+        this->capacity = capacity;
+        count = 0;
+    }
+
+    /// Количество записанных байтов, в том числе не поместившихся в буфер
+    size_t size() const
+    {
+        return count;
+    }
+
+protected:
+    streamsize xsputn(const char* s, streamsize n)
+    {
+        if (grow != nullptr)
+            grow->insert(grow->end(), (const uint8_t*)s, (const uint8_t*)s + n);
+        else if (count < capacity)
+            memcpy(fixed + count, s, min((size_t)n, capacity - count));
+
+        count += (size_t)n;
+
+        return n;
+    }
+
+    int_type overflow(int_type ch)
+    {
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+
+        char c = traits_type::to_char_type(ch);
+        xsputn(&c, 1);
+
+        return ch;
+    }
+
+private:
+    vector<uint8_t>* grow;      // растущий массив (или nullptr)
+    uint8_t* fixed;             // буфер фиксированного размера (или nullptr)
+    size_t capacity;
+    size_t count;               // количество записанных байтов
+};
\ No newline at end of file
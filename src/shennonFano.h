@@ -1,149 +1,253 @@
 ﻿#pragma once
 
+#include <algorithm>
 #include <fstream>
 #include <string>
-#include <list>
+#include <vector>
 
 #include "IEncoder.h"
 #include "BitWriterReader.h"
 #include "frequancyEntropy.h"
+#include "syncPoints.h"
+#include "decodeTable.h"
 
 using namespace std;
 
 /// Алгоритм Шеннона-Фано
 class ShannonFano : public IEncoder
 {
-private:
-    class Node;
-
 public:
-    /// Кодирование файла по методу Шенона-Фано
-    /// \param file Поток исходного файла
-    /// \param directory Путь до папки, в которой лежит файл
-    /// \param fileName Имя кодируемого файла
-    void pack(ifstream& file, string directory, string fileName)
+    /// \param threads Количество потоков выполнения для распаковки
+    /// \param syncInterval Расстояние между точками синхронизации в килобайтах исходного файла (0 - без точек).
+    /// Распаковка в несколько потоков выполнения возможна только для файлов с точками синхронизации
+    ShannonFano(unsigned int threads = 1, unsigned int syncInterval = 0)
+        : sync(syncInterval * 1024)
+    {
+        this->threads = threads;
+    }
+
+    /// Коэффицент сжатия для данного алгоритма
+    /// \return Отношение объема исходных данных к закодированным (больше - лучше)
+    double getCompression()
     {
-        // Получение исходных данных: частоты и количество символов
-        sum = FrequancyEntropy::countFrequancy(file, freq);
+        return compression;
+    }
+
+    string getName()
+    {
+        return threads > 1 ? "Shanon-Fano(" + to_string(threads) + " threads)" : "Shanon-Fano";
+    }
+
+    string getExtension()
+    {
+        return "shan";
+    }
+
+protected:
+    /// Кодирование по методу Шенона-Фано
+    /// \param input Исходные данные
+    /// \param bw Поток для записи
+    void encode(InputSource& input, BitWriter& bw)
+    {
+        // Данные проходятся дважды, поэтому поток, который нельзя перемотать (канал), читается в память
+        if (!input.rewind())
+            input.load();
+
+        // Получение исходных данных: частоты и количество символов (файл может быть больше 4 ГБ)
+        freq = new unsigned long long[256];
+        sum = FrequancyEntropy::countFrequancy(input, freq);
+        input.rewind();
 
         // Запуск алгоритма
-        build(true);
+        build();
 
-        // Упаковка данных в файл
-        BitWriter bw(directory + "pack/" + fileName + ".shan");
+        // Запись частот: ширина частоты в байтах, по биту на каждый символ (встречается ли он в файле),
+        // затем частоты только встречающихся символов. Самая большая частота - первая в отсортированных
+        char width = counts[0] > 0xFFFFFFFFull ? 8 : 4;
+        bw << width;
+
+        for (int i = 0; i < 256; i++)
+            bw << (matr[i] != -1);
 
-        // Запись частот в файл
         for (int i = 0; i < 256; i++)
         {
-            if (matr[i] == -1) 
-                bw << (unsigned int)0;
-            else 
-                bw << freq[matr[i]];
+            if (matr[i] == -1)
+                continue;
+
+            if (width == 8)
+                bw << counts[matr[i]];
+            else
+                bw << (unsigned int)counts[matr[i]];
         }
+
+        bw << sync.getInterval();
             
         // Запись закодированного сообщения в битах в файл
-        char ch;
-        list<bool> code;
-        
-        file.clear();
-        file.seekg(0);
+        sync.clear();
 
-        while (file.get(ch))
-        {
-            code = codes[matr[(unsigned char)ch]];
+        encodeStream(input, bw);
 
-            for (bool c : code)
-                bw << c;
-        }
+        if (sync.getInterval() != 0)
+            sync.write(bw);
 
         // Определение коэффицента сжатия
-        file.clear();
-        file.seekg(0, file.end);
-        compression = file.tellg() / (double)bw.getFileSize();
+        compression = sum / (double)bw.getFileSize();
 
         // Освобождение ресурсов
-        bw.close();
         delete[] matr;
         delete[] freq;
-        delete[] codes;
     }
 
-    /// Декодирование закодированного файла по методу Шенона-Фано
-    /// \param file Поток исходного файла
-    /// \param directory Путь до папки, в которой лежит файл
-    /// \param fileName Имя кодируемого файла
-    void unpack(string directory, string fileName)
+    /// Декодирование сообщения, закодированного по методу Шенона-Фано
+    /// \param br Поток закодированного сообщения
+    /// \param res Поток для раскодированного сообщения
+    /// \return false, если сообщение повреждено или обрывается
+    bool decode(BitReader& br, ostream& res)
     {
-        freq = new unsigned int[256];
+        freq = new unsigned long long[256];
         sum = 0;
 
-        // Считывание массива частот 
-        BitReader br(directory + "pack/" + fileName + ".shan");
+        // Считывание частот: ширина, признаки встречающихся символов, частоты встречающихся символов
+        char width;
+        br >> width;
+
+        bool present[256];
+        for (int i = 0; i < 256; i++)
+            br >> present[i];
+
         for (int i = 0; i < 256; i++)
         {
-            br >> freq[i];
+            freq[i] = 0;
+            if (present[i] && width == 8)
+                br >> freq[i];
+            else if (present[i])
+            {
+                unsigned int count;
+                br >> count;
+                freq[i] = count;
+            }
+
+            // Сумма 64-битных частот из поврежденного заголовка может переполниться
+            if (freq[i] > ~0ull - sum)
+            {
+                delete[] freq;
+                return false;
+            }
+
             sum += freq[i];
         }
 
-        // Восстановление дерева по массиву частот
-        build(false);
-
-        // Готовим файл для записи раскодированного сообщения
-        ofstream encodeFile;
-        encodeFile.open(directory + "unpack/" + fileName + ".unshan", ios::binary);
-        
-        // Считывание битов, проход по дереву кодов, запись символов в файл
-        bool bit;
-        Node* currentNode = rootNode;
+        unsigned int syncInterval;
+        br >> syncInterval;
 
-        while (br >> bit)
+        if (!br || (width != 4 && width != 8))
         {
-            currentNode = bit ? currentNode->oneChild : currentNode->zeroChild;
-
-            if (currentNode->isLeaf())
-            {
-                encodeFile << (char)currentNode->value; // добавление в файл символа
-                currentNode = rootNode;
-            }
+            delete[] freq;
+            return false;
         }
+
+        // Восстановление кодов по массиву частот и построение таблицы декодирования
+        build();
+        table.build(codes, lengths);
+
+        // Декодирование по таблице сразу по нескольким битам, запись символов в поток
+        bool decoded;
+        if (syncInterval != 0 && threads > 1)
+            decoded = decodeParallel(br, syncInterval, res);
+        else
+            decoded = table.decode(br, res, sum);
         
         // Освобождение ресурсов
-        br.close();
-        encodeFile.close();
         delete[] matr;
         delete[] freq;
-        delete rootNode;
+
+        return decoded;
     }
 
-    /// Коэффицент сжатия для данного алгоритма
-    /// \return Отношение объема исходных данных к закодированным (больше - лучше)
-    double getCompression()
+private:
+    /// Запись кодов всех символов файла
+    /// \param input Исходные данные
+    /// \param bw Поток для записи
+    void encodeStream(InputSource& input, BitWriter& bw)
     {
-        return compression;
+        unsigned long long start = bw.getBitPosition();
+        unsigned long long position = 0;
+
+        const char* chunk;
+        size_t count;
+        while ((count = input.read(chunk, InputSource::CHUNK_SIZE)) != 0)
+        {
+            for (size_t i = 0; i < count; i++, position++)
+            {
+                if (position == sync.getNext())
+                    sync.add(bw.getBitPosition() - start);
+
+                unsigned char c = (unsigned char)chunk[i];
+                bw.writeBits(codes[c], lengths[c]);
+            }
+        }
     }
 
-    string getName()
+    /// Декодирование в несколько потоков выполнения по точкам синхронизации
+    /// \param br Поток закодированного сообщения
+    /// \param syncInterval Расстояние между точками синхронизации в символах
+    /// \param res Поток для раскодированного сообщения
+    /// \return false, если точки синхронизации или битовый поток повреждены (тогда ничего не записывается)
+    bool decodeParallel(BitReader& br, unsigned int syncInterval, ostream& res)
     {
-        return "Shanon-Fano";
+        vector<char> data;
+        br.readRest(data);
+
+        SyncPoints points(syncInterval);
+        size_t size;
+
+        // Каждый символ занимает хотя бы бит: большая сумма частот означает поврежденный заголовок
+        if (!points.read(data, size) || sum > (unsigned long long)size * 8)
+            return false;
+
+        vector<char> output((size_t)sum);
+
+        bool decoded = points.decode(data.data(), size, sum, output.data(), threads,
+            [this](BitReader& segment, char* out, unsigned long long count)
+            {
+                return table.decode(segment, out, count);
+            });
+
+        if (!decoded)
+            return false;
+
+        res.write(output.data(), output.size());
+        return true;
     }
 
-private:
-    /// Точка входа в алгоритм
-    /// \param packMode Флаг, отвечающий за то, в каком режиме будет выполнен алгоритм: упаковка или распаковка
-    void build(bool packMode)
+    /// Точка входа в алгоритм: построение таблицы кодов по частотам (одинаково для упаковки и распаковки)
+    void build()
     {
         // Сортировка исходного массива, получение матрицы переходов и определение индекса 
         int lastInd = sort();
 
-        if (packMode)
+        // Коды строятся по индексам в отсортированном массиве
+        for (int i = 0; i < 256; i++)
         {
-            codes = new list<bool>[256];
-            recursiveDivision(0, lastInd, sum);
+            codes[i] = 0;
+            lengths[i] = 0;
         }
-        else
+
+        if (lastInd == 0)       // единственному символу тоже нужен код
+            lengths[0] = 1;
+        else if (lastInd > 0)
+            recursiveDivision(0, lastInd, weight);
+
+        // Перестановка таблицы кодов по кодам символов, чтобы при упаковке не обращаться к matr
+        unsigned long long sortedCodes[256];
+        unsigned char sortedLengths[256];
+        copy(codes, codes + 256, sortedCodes);
+        copy(lengths, lengths + 256, sortedLengths);
+
+        for (int i = 0; i < 256; i++)
         {
-            rootNode = new Node();
-            recursiveDivision(0, lastInd, sum, rootNode);
+            codes[i] = matr[i] != -1 ? sortedCodes[matr[i]] : 0;
+            lengths[i] = matr[i] != -1 ? sortedLengths[matr[i]] : 0;
         }
     }
 
@@ -151,64 +255,38 @@ private:
     /// \param left Левая граница интервала в массиве 
     /// \param right Правая граница интервала в массиве
     /// \param sum Сумма символов в данном интервале
-    void recursiveDivision(int left, int right, unsigned int sum, Node* currentNode = nullptr)
+    void recursiveDivision(int left, int right, unsigned long long sum)
     {
-        if (left == right) return;
+        if (left >= right) return;
 
         int i;
-        unsigned int s = 0;
+        unsigned long long s = 0;
 
         for (i = left; i < right; i++)
         {
             s += freq[i];
-            if ((int)(sum - 2 * s) <= (int)(2 * (s + freq[i + 1]) - sum)) break;
+            if ((long long)(sum - 2 * s) <= (long long)(2 * (s + freq[i + 1]) - sum)) break;
         }
 
-        // Режим упаковки: дерево не строится, коды каждого символа храняться в векторах
-        if (currentNode == nullptr)
-        {
-            for (int j = left; j <= i; j++)
-                codes[j].push_back(true);
-
-            for (int j = i + 1; j <= right; j++)
-                codes[j].push_back(false);
+        // Граница раздела не должна выходить за интервал
+        if (i > right - 1)
+            i = right - 1;
 
-            recursiveDivision(left, i, s);
-            recursiveDivision(i + 1, right, sum - s);
-        }
-        // Режим распаковки: строится кодовое дерево, по которому будут восстанвливаться символы
-        else    
+        // К кодам каждого символа дописывается очередной бит
+        for (int j = left; j <= i; j++)
         {
-            Node* zeroChild, *oneChild;
-
-            if (left == i)      // добрались до листа
-            {
-                int j = 0;
-                while (matr[j] != left) j++;      // поиск первоначального индекса (кода символа)
-
-                oneChild = new Node(j);
-            }
-            else
-            {
-                oneChild = new Node();
-                recursiveDivision(left, i, s, oneChild);
-            }
-
-            if (right == i + 1)     // добрались до листа
-            {
-                int j = 0;
-                while (matr[j] != right) j++;     // поиск первоначального индекса (кода символа)
-
-                zeroChild = new Node(j);
-            }
-            else   
-            {
-                zeroChild = new Node();
-                recursiveDivision(i + 1, right, sum - s, zeroChild);
-            }
+            codes[j] = (codes[j] << 1) | 1;
+            lengths[j]++;
+        }
 
-            currentNode->addChildren(zeroChild, oneChild);
+        for (int j = i + 1; j <= right; j++)
+        {
+            codes[j] <<= 1;
+            lengths[j]++;
         }
+
+        recursiveDivision(left, i, s);
+        recursiveDivision(i + 1, right, sum - s);
     }
 
     /// Сортировки исходного массива freq и определение
@@ -216,41 +294,47 @@ private:
     /// \return Индекс, с которого начинаются символы, частота которых = 0
     int sort()
     {
+        // Символы по убыванию частоты (при равных частотах - по возрастанию кода символа)
+        int symbols[256];
+        for (int i = 0; i < 256; i++)
+            symbols[i] = i;
+
+        unsigned long long* f = freq;
+        stable_sort(symbols, symbols + 256, [f](int a, int b) { return f[a] > f[b]; });
+
         // Инициализация матрицы перехода
         matr = new int[256];
         for (int i = 0; i < 256; i++)
             matr[i] = -1;       // флаг -1 значит, что символов с индексом i не было в последовательности
 
-        unsigned int* mas = new unsigned int[256];  // отсортированный массив
-
-        int maxInd, lastInd = n - 1;
-        unsigned int max;
+        unsigned long long* mas = new unsigned long long[256];  // отсортированный массив
+        int lastInd = -1;
 
         // Занесение сортированных данных в новый массив
-        for (int i = 0; i < 256; i++)
+        for (int i = 0; i < n; i++)
         {
-            max = 0;
-            for (int j = 0; j < 256; j++)
-            {
-                if (max < freq[j])
-                {
-                    max = freq[j];
-                    maxInd = j;
-                }
-            }
+            mas[i] = freq[symbols[i]];
+            counts[i] = mas[i];
 
-            if (max == 0)
+            if (mas[i] != 0)
             {
-                for (int k = i; k < 256; k++)
-                    mas[k] = 0;
-
-                lastInd = i - 1;
-                break;
+                matr[symbols[i]] = i;
+                lastInd = i;
             }
+        }
 
-            freq[maxInd] = 0;
-            mas[i] = max;
-            matr[maxInd] = i;
+        // Для файлов больше 4 ГБ коды строятся по уменьшенным частотам, чтобы код не вышел за 57 бит.
+        // Сдвиг сохраняет порядок частот и определяется только суммой, поэтому распаковка строит те же коды
+        int shift = 0;
+        while ((sum >> shift) > 0xFFFFFFFFull - 256)
+            shift++;
+
+        weight = 0;
+        for (int i = 0; i <= lastInd; i++)
+        {
+            if (shift != 0)
+                mas[i] = max(mas[i] >> shift, 1ull);
+            weight += mas[i];
         }
 
         delete[] freq;
@@ -259,55 +343,22 @@ private:
         return lastInd;
     }
 
-private:
-    /// Класс, представляющий собой узел дерева
-    class Node
-    {
-    public:
-        Node()
-        {
-            value = 0;
-        }
-
-        Node(unsigned char value)
-        {
-            this->value = value;
-        }
-
-        ~Node()
-        {
-            delete zeroChild;
-            delete oneChild;
-        }
-
-        bool isLeaf()
-        {
-            if (zeroChild == nullptr) 
-                return true;
-            else 
-                return false;
-        }
-
-        void addChildren(Node* zero, Node* one)
-        {
-            zeroChild = zero;
-            oneChild = one;
-        }
-
-        Node* zeroChild;
-        Node* oneChild;
-        unsigned char value;    // код символа
-    };
-
 private:
     int n = 256;
     double compression;
+    unsigned int threads;
+    SyncPoints sync;        // точки синхронизации упаковываемого файла
+
+    DecodeTable table;      // для распаковки по кодам строится таблица декодирования
 
-    Node* rootNode;         // для распаковки мы строим дерево с кодами
-    list<bool>* codes;      // для упаковки мы создаем массив list-ов для хранения кодов, каждое значение по индексу соответствует символу в массиве частот 
-                            // Каждый list - это последовательноть бит 
+    // Таблица кодов символов (первый бит кода - старший). Каждая часть разбиения весит меньше 2/3
+    // своего интервала, поэтому при суммарной частоте меньше 2^32 код не длиннее 57 бит и пишется одним writeBits
+    unsigned long long codes[256];
+    unsigned char lengths[256];
 
     int* matr;              // матрица перехода между изначальными частотами и отсортированными
-    unsigned int sum;       // количество символов в файле
-    unsigned int* freq;     // массив частот (количество каждого символа)
+    unsigned long long sum;         // количество символов в файле
+    unsigned long long* freq;       // массив частот (количество каждого символа)
+    unsigned long long counts[256]; // отсортированные частоты до уменьшения (пишутся в заголовок)
+    unsigned long long weight;      // сумма частот, по которым строятся коды
 };
\ No newline at end of file
@@ -0,0 +1,168 @@
+﻿#pragma once
+
+#include <thread>
+#include <vector>
+
+#include "BitWriterReader.h"
+
+using namespace std;
+
+/// Точки синхронизации битового потока
+///
+/// Кодер через каждые interval символов запоминает текущую позицию в битовом потоке. Точки записываются
+/// в конец файла после потока, поэтому декодер может разбить поток на отрезки между точками и декодировать
+/// их одновременно в несколько потоков выполнения, записывая каждый отрезок сразу на его место в результате
+class SyncPoints
+{
+public:
+    /// Точка синхронизации
+    struct Point
+    {
+        unsigned long long bitOffset;       // смещение от начала битового потока в битах
+        unsigned long long outputOffset;    // номер первого символа, код которого начинается с этого смещения
+    };
+
+    /// \param interval Количество символов между соседними точками (0 - точки не записываются)
+    SyncPoints(unsigned int interval = 0)
+    {
+        this->interval = interval;
+        clear();
+    }
+
+    /// Подготовка к кодированию нового файла
+    void clear()
+    {
+        points.clear();
+        next = interval != 0 ? interval : ~0ULL;
+    }
+
+    unsigned int getInterval()
+    {
+        return interval;
+    }
+
+    /// Номер символа, перед которым нужно поставить следующую точку
+    unsigned long long getNext()
+    {
+        return next;
+    }
+
+    /// Добавление точки (вызывается кодером перед символом с номером getNext())
+    /// \param bitOffset Смещение кода этого символа от начала битового потока
+    void add(unsigned long long bitOffset)
+    {
+        points.push_back(Point{ bitOffset, next });
+        next += interval;
+    }
+
+    /// Добавление точек, найденных отдельно (например, разными потоками выполнения)
+    void append(const vector<Point>& part)
+    {
+        points.insert(points.end(), part.begin(), part.end());
+    }
+
+    /// Запись точек после битового потока: сами точки, затем их количество
+    void write(BitWriter& bw)
+    {
+        for (Point& p : points)
+            bw << p.bitOffset << p.outputOffset;
+
+        bw << (unsigned int)points.size();
+    }
+
+    /// Считывание точек из конца данных
+    /// \param data Битовый поток вместе с записанными после него точками
+    /// \param size Сюда записывается размер битового потока в байтах
+    /// \return false, если точки не помещаются в данные
+    bool read(const vector<char>& data, size_t& size)
+    {
+        points.clear();
+        if (data.size() < 4)
+            return false;
+
+        unsigned int count;
+        BitReader(data.data() + data.size() - 4, 4) >> count;
+
+        if ((size_t)count > (data.size() - 4) / 16)
+            return false;
+
+        size = data.size() - 4 - (size_t)count * 16;
+        BitReader br(data.data() + size, (size_t)count * 16);
+
+        points.resize(count);
+        for (Point& p : points)
+            br >> p.bitOffset >> p.outputOffset;
+
+        return true;
+    }
+
+    /// Декодирование потока по отрезкам между точками в несколько потоков выполнения
+    /// \param data Битовый поток
+    /// \param size Размер битового потока в байтах
+    /// \param n Количество символов в сообщении
+    /// \param output Буфер для всего раскодированного сообщения
+    /// \param threads Количество потоков выполнения
+    /// \param decodeSegment Функция декодирования отрезка: (BitReader&, char* out, unsigned long long count),
+    /// возвращает false, если отрезок поврежден
+    /// \return false, если точки или какой-то из отрезков повреждены
+    template <class Decoder>
+    bool decode(const char* data, size_t size, unsigned long long n, char* output, unsigned int threads, Decoder decodeSegment)
+    {
+        // Первый отрезок начинается с начала потока
+        vector<Point> starts(1, Point{ 0, 0 });
+        starts.insert(starts.end(), points.begin(), points.end());
+
+        // Точки стоят перед каждым interval-м символом и идут по потоку по порядку, иначе отрезки запишут мимо
+        // буфера. Неверное количество точек означает, что конец данных с точками оборван
+        if (interval != 0 && points.size() != (n == 0 ? 0 : (n - 1) / interval))
+            return false;
+
+        for (size_t s = 1; s < starts.size(); s++)
+        {
+            const Point& p = starts[s];
+            if ((interval != 0 && p.outputOffset != s * interval) || p.outputOffset < starts[s - 1].outputOffset ||
+                p.outputOffset > n || p.bitOffset < starts[s - 1].bitOffset || p.bitOffset > (unsigned long long)size * 8)
+                return false;
+        }
+
+        size_t segments = starts.size();
+        vector<char> decoded(segments, 0);
+        vector<thread> workers;
+
+        for (unsigned int t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t]()
+            {
+                // Каждый поток выполнения декодирует несколько соседних отрезков
+                for (size_t s = segments * t / threads; s < segments * (t + 1) / threads; s++)
+                {
+                    const Point& p = starts[s];
+                    unsigned long long end = s + 1 < segments ? starts[s + 1].outputOffset : n;
+
+                    size_t byte = (size_t)(p.bitOffset / 8);
+                    BitReader br(data + byte, size - byte);
+
+                    int skip = (int)(p.bitOffset % 8);
+                    br.peekBits(skip);
+                    br.skipBits(skip);
+
+                    decoded[s] = decodeSegment(br, output + p.outputOffset, end - p.outputOffset);
+                }
+            });
+        }
+
+        for (thread& worker : workers)
+            worker.join();
+
+        for (char ok : decoded)
+            if (!ok)
+                return false;
+
+        return true;
+    }
+
+private:
+    unsigned int interval;
+    unsigned long long next;        // номер символа для следующей точки
+    vector<Point> points;
+};
\ No newline at end of file